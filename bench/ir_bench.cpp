@@ -0,0 +1,167 @@
+// Microbenchmarks for struct_filter and util hot paths on generated modules
+#include <benchmark/benchmark.h>
+#include "llvm/IR/Module.h"
+#include "llvm/IR/LLVMContext.h"
+#include "../struct_filter.h"
+#include "../util.h"
+
+using namespace llvm;
+
+// Module with `size` identified structs:
+//   every 4th struct has a function pointer,
+//   every struct embeds the previous one and points to a random earlier one,
+//   a function per struct loads, stores and casts through its fields
+static std::unique_ptr<Module> generateModule(LLVMContext &ctx, size_t size) {
+    auto M = std::make_unique<Module>("bench", ctx);
+    auto *i8_ptr = Type::getInt8PtrTy(ctx);
+    auto *i32 = Type::getInt32Ty(ctx);
+    auto *fptr = FunctionType::get(Type::getVoidTy(ctx), {i8_ptr}, false)->getPointerTo();
+
+    std::vector<StructType*> types;
+    uint64_t seed = 239;
+    for (size_t i = 0; i < size; i++) {
+        std::vector<Type*> fields = {i32};
+        if (i % 4 == 0) {
+            fields.push_back(fptr);
+        }
+        if (i > 0) {
+            seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+            fields.push_back(types.back());
+            fields.push_back(types[(seed >> 33) % types.size()]->getPointerTo());
+        }
+        types.push_back(StructType::create(ctx, fields, "struct.bench_" + std::to_string(i)));
+    }
+
+    IRBuilder<> builder(ctx);
+    for (auto *T : types) {
+        auto *f = Function::Create(
+                FunctionType::get(Type::getVoidTy(ctx), {T->getPointerTo()}, false),
+                Function::ExternalLinkage, "use_" + T->getName(), *M
+        );
+        builder.SetInsertPoint(BasicBlock::Create(ctx, "", f));
+        auto last = T->getNumElements() - 1;
+        auto *field = builder.CreateStructGEP(T, f->getArg(0), last);
+        auto *val = builder.CreateLoad(T->getElementType(last), field);
+        builder.CreateStore(val, field);
+        builder.CreateBitCast(f->getArg(0), i8_ptr);
+        builder.CreateRetVoid();
+    }
+    return M;
+}
+
+// Interesting types, pointers to them and unrelated types
+static std::vector<Type*> queryTypes(Module &M) {
+    std::vector<Type*> res;
+    for (auto *T : M.getIdentifiedStructTypes()) {
+        res.push_back(T);
+        res.push_back(T->getPointerTo());
+    }
+    res.push_back(Type::getInt32Ty(M.getContext()));
+    res.push_back(Type::getInt8PtrTy(M.getContext()));
+    return res;
+}
+
+static void BM_StructFilterBuild(benchmark::State &state) {
+    LLVMContext ctx;
+    auto M = generateModule(ctx, state.range(0));
+    for (auto _ : state) {
+        struct_filter filter(M.get());
+        benchmark::DoNotOptimize(filter.getInterestingTypes().size());
+    }
+    state.SetComplexityN(state.range(0));
+}
+
+static void BM_IsInterestingType(benchmark::State &state) {
+    LLVMContext ctx;
+    auto M = generateModule(ctx, state.range(0));
+    struct_filter filter(M.get());
+    auto types = queryTypes(*M);
+    for (auto _ : state) {
+        for (auto *t : types) {
+            benchmark::DoNotOptimize(filter.isInterestingType(t));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * types.size());
+}
+
+static void BM_IsPtrToInterestingType(benchmark::State &state) {
+    LLVMContext ctx;
+    auto M = generateModule(ctx, state.range(0));
+    struct_filter filter(M.get());
+    auto types = queryTypes(*M);
+    for (auto _ : state) {
+        for (auto *t : types) {
+            benchmark::DoNotOptimize(filter.isPtrToInterestingType(t));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * types.size());
+}
+
+static void BM_GetStructType(benchmark::State &state) {
+    LLVMContext ctx;
+    auto M = generateModule(ctx, state.range(0));
+    auto types = queryTypes(*M);
+    for (auto _ : state) {
+        for (auto *t : types) {
+            benchmark::DoNotOptimize(getStructType(t));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * types.size());
+}
+
+static void BM_DereferenceStructPtr(benchmark::State &state) {
+    LLVMContext ctx;
+    auto M = generateModule(ctx, state.range(0));
+    auto types = queryTypes(*M);
+    for (auto _ : state) {
+        for (auto *t : types) {
+            benchmark::DoNotOptimize(dereferenceStructPtr(t));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * types.size());
+}
+
+// Names are absent from the module: found structs are printed, which would dominate the timing
+static void BM_FindAllStructsByName(benchmark::State &state) {
+    LLVMContext ctx;
+    auto M = generateModule(ctx, state.range(0));
+    std::unordered_set<std::string> names = {"struct.list_head", "struct.hlist_node", "struct.llist_node"};
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(findAllStructsByName(*M, names).size());
+    }
+    state.SetComplexityN(state.range(0));
+}
+
+// Emit a copy for every struct into a scratch function, the function is dropped after each iteration
+static void BM_CopyStructBetweenPointers(benchmark::State &state) {
+    LLVMContext ctx;
+    auto M = generateModule(ctx, state.range(0));
+    IRBuilder<> builder(ctx);
+    auto types = M->getIdentifiedStructTypes();
+    for (auto _ : state) {
+        auto *f = Function::Create(
+                FunctionType::get(Type::getVoidTy(ctx), {Type::getInt8PtrTy(ctx)}, false),
+                Function::ExternalLinkage, "scratch", *M
+        );
+        builder.SetInsertPoint(BasicBlock::Create(ctx, "", f));
+        for (auto *T : types) {
+            auto *ptr = builder.CreateBitCast(f->getArg(0), T->getPointerTo());
+            copyStructBetweenPointers(*M, builder, T, ptr, ptr);
+        }
+        builder.CreateRetVoid();
+        f->eraseFromParent();
+    }
+    state.SetItemsProcessed(state.iterations() * types.size());
+}
+
+#define MODULE_SIZES RangeMultiplier(8)->Range(64, 32768)
+
+BENCHMARK(BM_StructFilterBuild)->MODULE_SIZES->Complexity();
+BENCHMARK(BM_IsInterestingType)->MODULE_SIZES;
+BENCHMARK(BM_IsPtrToInterestingType)->MODULE_SIZES;
+BENCHMARK(BM_GetStructType)->MODULE_SIZES;
+BENCHMARK(BM_DereferenceStructPtr)->MODULE_SIZES;
+BENCHMARK(BM_FindAllStructsByName)->MODULE_SIZES->Complexity();
+BENCHMARK(BM_CopyStructBetweenPointers)->MODULE_SIZES;
+
+BENCHMARK_MAIN();
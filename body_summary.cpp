@@ -0,0 +1,160 @@
+#include "body_summary.h"
+#include "llvm/IR/IntrinsicInst.h"
+
+static bool containsPointer(Type *t) {
+    if (t->isPointerTy()) {
+        return true;
+    }
+    return std::ranges::any_of(t->subtypes(), [](Type *sub) { return containsPointer(sub); });
+}
+
+// Check if a pointer may leave the function through this instruction
+static bool hasPointerEffects(Instruction &inst, std::vector<std::string> &callees,
+                              const std::unordered_set<std::string> *defined_names) {
+    if (auto *store = dyn_cast<StoreInst>(&inst)) {
+        // Pointers are saved somewhere, they may be read later
+        return containsPointer(store->getValueOperand()->getType());
+    }
+    if (auto *rmw = dyn_cast<AtomicRMWInst>(&inst)) {
+        return containsPointer(rmw->getValOperand()->getType());
+    }
+    if (auto *cmpxchg = dyn_cast<AtomicCmpXchgInst>(&inst)) {
+        return containsPointer(cmpxchg->getNewValOperand()->getType());
+    }
+    if (auto *ret = dyn_cast<ReturnInst>(&inst)) {
+        auto *ret_val = ret->getReturnValue();
+        return ret_val && containsPointer(ret_val->getType());
+    }
+    if (isa<PtrToIntInst>(&inst) || isa<IntToPtrInst>(&inst)) {
+        // Pointer may be hidden in an integer
+        return true;
+    }
+    if (isa<MemTransferInst>(&inst)) {
+        // memcpy and memmove may move pointers
+        return true;
+    }
+    if (auto *call = dyn_cast<CallBase>(&inst)) {
+        if (isa<IntrinsicInst>(call)) {
+            return false;
+        }
+        auto *callee = call->getCalledFunction();
+        if (!callee || call->isInlineAsm() || !callee->hasName()) {
+            return true;
+        }
+        bool defined = defined_names ? defined_names->contains(callee->getName().str()) : !callee->isDeclaration();
+        if (!defined) {
+            // Unknown function may do anything with passed pointers
+            return containsPointer(callee->getFunctionType());
+        }
+        callees.push_back(callee->getName().str());
+    }
+    return false;
+}
+
+body_facts collectBodyFacts(Function &f, const std::unordered_set<std::string> *defined_names) {
+    body_facts facts;
+    facts.types.insert(f.getReturnType());
+    for (auto *param : f.getFunctionType()->params()) {
+        facts.types.insert(param);
+    }
+    for (auto &bb : f) {
+        for (auto &inst : bb) {
+            facts.types.insert(inst.getType());
+            auto *call_inst = dyn_cast<CallBase>(&inst);
+            for (auto *op : inst.operand_values()) {
+                // Direct callee is checked by its name
+                if (call_inst && op == call_inst->getCalledOperand() && isa<Function>(op)) {
+                    continue;
+                }
+                facts.types.insert(op->getType());
+            }
+            if (auto *alloca = dyn_cast<AllocaInst>(&inst)) {
+                facts.types.insert(alloca->getAllocatedType());
+            } else if (auto *gep = dyn_cast<GetElementPtrInst>(&inst)) {
+                facts.types.insert(gep->getSourceElementType());
+            }
+            if (!facts.pointer_effects) {
+                facts.pointer_effects = hasPointerEffects(inst, facts.callees, defined_names);
+            }
+        }
+    }
+    return facts;
+}
+
+body_summarizer::body_summarizer(struct_filter &type_tracker): type_tracker(type_tracker) {}
+
+bool body_summarizer::isTrackedType(Type *t) {
+    while (t->isPointerTy() || t->isArrayTy() || t->isVectorTy()) {
+        if (t->isPointerTy()) {
+            t = t->getNonOpaquePointerElementType();
+        } else if (t->isArrayTy()) {
+            t = t->getArrayElementType();
+        } else {
+            t = dyn_cast<VectorType>(t)->getElementType();
+        }
+    }
+    if (t->isFunctionTy()) {
+        return true;
+    }
+    if (auto *st = dyn_cast<StructType>(t)) {
+        if (type_tracker.isInterestingType(st)) {
+            return true;
+        }
+        // Literal structs cannot be recursive, so it is safe to go deeper
+        if (st->isLiteral()) {
+            return std::ranges::any_of(st->elements(), [this](Type *el) { return isTrackedType(el); });
+        }
+    }
+    return false;
+}
+
+void body_summarizer::addFunction(const std::string &name, body_facts facts) {
+    if (facts.pointer_effects || std::ranges::any_of(facts.types, [this](Type *t) { return isTrackedType(t); })) {
+        return;
+    }
+    facts.types.clear();
+    functions[name] = std::move(facts);
+}
+
+std::unordered_set<std::string> body_summarizer::findSummarizable() {
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (auto it = functions.begin(); it != functions.end();) {
+            bool callees_summarized = std::ranges::all_of(
+                    it->second.callees,
+                    [this](const std::string &callee) { return functions.contains(callee); }
+            );
+            if (callees_summarized) {
+                it++;
+            } else {
+                it = functions.erase(it);
+                changed = true;
+            }
+        }
+    }
+    std::unordered_set<std::string> res;
+    for (auto &[name, facts] : functions) {
+        res.insert(name);
+    }
+    return res;
+}
+
+void body_summarizer::summarizeFunction(Function *f) {
+    auto linkage = f->getLinkage();
+    auto visibility = f->getVisibility();
+    // Debug info keeps the source location for the debug map, scopes and hub partitions
+    auto *subprogram = f->getSubprogram();
+    f->deleteBody();
+    f->setLinkage(linkage);
+    f->setVisibility(visibility);
+    f->setSubprogram(subprogram);
+
+    IRBuilder<> builder(f->getContext());
+    builder.SetInsertPoint(BasicBlock::Create(f->getContext(), "", f));
+    if (f->getReturnType()->isVoidTy()) {
+        builder.CreateRetVoid();
+    } else {
+        builder.CreateRet(Constant::getNullValue(f->getReturnType()));
+    }
+}
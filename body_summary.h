@@ -0,0 +1,45 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include "llvm/IR/IRBuilder.h"
+#include "struct_filter.h"
+
+using namespace llvm;
+
+// Facts about a function body, that do not depend on the set of interesting types
+// Collected facts stay valid after the body is deleted, so huge modules can be scanned in chunks
+struct body_facts {
+    // Pointer is stored, returned, hidden in an integer, copied by memcpy or passed to an unknown function
+    bool pointer_effects = false;
+    // Types of the signature, instructions and operands
+    std::unordered_set<Type*> types;
+    // Names of directly called defined functions
+    std::vector<std::string> callees;
+};
+
+// defined_names must be given if bodies of some defined functions were already deleted
+body_facts collectBodyFacts(Function &f, const std::unordered_set<std::string> *defined_names = nullptr);
+
+// Decides which bodies never touch interesting objects or function pointers
+class body_summarizer {
+public:
+    explicit body_summarizer(struct_filter &type_tracker);
+
+    void addFunction(const std::string &name, body_facts facts);
+
+    // Functions, that can be summarized. A function calling another defined function
+    // is summarized only if the callee is summarized too.
+    std::unordered_set<std::string> findSummarizable();
+
+    // Replace function body with a trivial one, returning a zero value, the subprogram is kept
+    // Works on functions, that are not materialized yet, but their subprogram is not loaded then
+    static void summarizeFunction(Function *f);
+private:
+    struct_filter &type_tracker;
+    std::unordered_map<std::string, body_facts> functions;
+
+    // Check if a value of this type can carry an interesting object or a function pointer
+    bool isTrackedType(Type *t);
+};
@@ -0,0 +1,49 @@
+#include "debug_map.h"
+#include "llvm/Support/raw_ostream.h"
+#include "util.h"
+
+uint32_t debug_map_writer::addFile(StringRef directory, StringRef file) {
+    auto path = joinSourcePath(directory, file);
+    auto [it, inserted] = file_ids.try_emplace(path, files.size());
+    if (inserted) {
+        files.push_back(path);
+    }
+    return it->second;
+}
+
+void debug_map_writer::addFunction(const Function &f) {
+    auto *sp = f.getSubprogram();
+    if (!sp) {
+        return;
+    }
+    auto file = addFile(sp->getDirectory(), sp->getFilename());
+    raw_string_ostream out(records);
+    out << "function " << f.getName() << " " << file << " " << sp->getLine() << "\n";
+}
+
+void debug_map_writer::addSite(const Function &f, uint32_t inst_idx, const DILocation *loc) {
+    auto file = addFile(loc->getDirectory(), loc->getFilename());
+    raw_string_ostream out(records);
+    out << "site " << f.getName() << "#" << inst_idx << " " << file << " " << loc->getLine() << " ";
+    out << loc->getColumn() << "\n";
+}
+
+bool debug_map_writer::write(const std::string &path, std::string &error) {
+    std::error_code ec;
+    raw_fd_ostream out(path, ec);
+    if (ec) {
+        error = "Cannot write debug map " + path + ": " + ec.message();
+        return false;
+    }
+    for (size_t i = 0; i < files.size(); i++) {
+        out << "file " << i << " " << files[i] << "\n";
+    }
+    out << records;
+    out.close();
+    if (out.has_error()) {
+        error = "Cannot write debug map " + path + ": " + out.error().message();
+        out.clear_error();
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,33 @@
+#pragma once
+// Source locations, that are kept when debug info is stripped from the instrumented module.
+// Text format, one record per line:
+//   file <id> <path>
+//   function <name> <file id> <line>
+//   site <function>#<instruction index> <file id> <line> <column>
+// Files are listed before the records, that refer to them. Instruction index counts instructions
+// of the input function body before instrumentation without debug intrinsics, the same way as call entries
+// of the sidecar index.
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/IR/Function.h"
+
+using namespace llvm;
+
+class debug_map_writer {
+public:
+    // Nothing is added for a function without a subprogram
+    void addFunction(const Function &f);
+
+    void addSite(const Function &f, uint32_t inst_idx, const DILocation *loc);
+
+    // Return false and set the error if the file cannot be written
+    bool write(const std::string &path, std::string &error);
+private:
+    std::vector<std::string> files;
+    std::unordered_map<std::string, uint32_t> file_ids;
+    std::string records;
+
+    uint32_t addFile(StringRef directory, StringRef file);
+};
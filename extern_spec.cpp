@@ -0,0 +1,77 @@
+#include "extern_spec.h"
+#include "util.h"
+
+static void specError(const std::string &path, const std::string &line, const std::string &msg) {
+    outs() << path << ": " << msg << " in line '" << line << "'\n";
+    outs().flush();
+    exit(1);
+}
+
+// "argN" -> N
+static std::optional<unsigned> parseArg(StringRef token) {
+    unsigned idx;
+    if (!token.consume_front("arg") || token.getAsInteger(10, idx)) {
+        return std::nullopt;
+    }
+    return idx;
+}
+
+extern_spec extern_spec::fromFile(const std::string &path) {
+    extern_spec spec;
+    for (auto &line : readConfigLines(path)) {
+        SmallVector<StringRef> tokens;
+        StringRef(line).split(tokens, ' ', -1, false);
+        if (tokens.size() < 2) {
+            specError(path, line, "missing effect");
+        }
+        extern_effect effect;
+        auto kind = tokens[1];
+        std::optional<unsigned> arg = tokens.size() > 2 ? parseArg(tokens[2]) : std::nullopt;
+        size_t expected_tokens = 3;
+        if (kind == "ignore") {
+            effect.kind = extern_effect::ignore;
+            expected_tokens = 2;
+        } else if (kind == "keep" || kind == "fill" || kind == "sync") {
+            if (!arg) {
+                specError(path, line, "expected argN");
+            }
+            effect.kind = kind == "keep" ? extern_effect::keep :
+                          kind == "fill" ? extern_effect::fill : extern_effect::sync;
+            effect.arg = *arg;
+        } else if (kind == "ret") {
+            if (tokens.size() > 2 && tokens[2] == "singleton") {
+                effect.kind = extern_effect::return_singleton;
+            } else if (tokens.size() > 2 && tokens[2] == "null") {
+                effect.kind = extern_effect::return_null;
+            } else if (arg) {
+                effect.kind = extern_effect::return_arg;
+                effect.arg = *arg;
+            } else {
+                specError(path, line, "expected argN, singleton or null");
+            }
+        } else if (kind == "store") {
+            // store argN argM.K
+            auto [dst, field] = tokens.size() > 3 ? tokens[3].split('.') : std::pair<StringRef, StringRef>();
+            auto dst_arg = parseArg(dst);
+            if (!arg || !dst_arg || field.getAsInteger(10, effect.field)) {
+                specError(path, line, "expected argN argM.K");
+            }
+            effect.kind = extern_effect::store;
+            effect.arg = *arg;
+            effect.dst_arg = *dst_arg;
+            expected_tokens = 4;
+        } else {
+            specError(path, line, "unknown effect");
+        }
+        if (tokens.size() != expected_tokens) {
+            specError(path, line, "unexpected tokens");
+        }
+        spec.models[tokens[0].str()].push_back(effect);
+    }
+    return spec;
+}
+
+const std::vector<extern_effect> *extern_spec::find(StringRef name) const {
+    auto it = models.find(name.str());
+    return it == models.end() ? nullptr : &it->second;
+}
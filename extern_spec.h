@@ -0,0 +1,43 @@
+#pragma once
+
+#include <unordered_map>
+#include "llvm/IR/IRBuilder.h"
+
+using namespace llvm;
+
+// What an external function does with its arguments
+struct extern_effect {
+    enum kind_t {
+        ignore,
+        keep,            // object pointed by arg is saved: arg -> singleton
+        fill,            // object pointed by arg is filled: singleton -> arg
+        sync,            // both, the default for unlisted functions
+        return_arg,
+        return_singleton,
+        return_null,
+        store,           // arg is stored into field of the object pointed by dst_arg
+    };
+    kind_t kind = ignore;
+    unsigned arg = 0;
+    unsigned dst_arg = 0;
+    unsigned field = 0;
+};
+
+// Models of declared functions, they replace the default bodies with whole-struct copies.
+// Spec file consists of lines "<function> <effect>", a function may have several lines:
+//   ignore                 no flows, default value is returned
+//   keep argN | fill argN | sync argN
+//   ret argN | ret singleton | ret null
+//   store argN argM.K      *argM.K = argN
+// Arguments are numbered from 0. Unlisted declarations keep the default model.
+class extern_spec {
+public:
+    extern_spec() = default;
+
+    static extern_spec fromFile(const std::string &path);
+
+    // Effects of the function or nullptr if it is not listed
+    [[nodiscard]] const std::vector<extern_effect>* find(StringRef name) const;
+private:
+    std::unordered_map<std::string, std::vector<extern_effect>> models;
+};
@@ -0,0 +1,75 @@
+#include "field_targets.h"
+#include "llvm/IR/IntrinsicInst.h"
+
+field_targets::field_targets(Module *M) : flows(std::make_shared<const fptr_flows>(*M)) {
+    for (auto &[path, val] : flows->getFieldStores()) {
+        addStoredValue(path.back(), val);
+    }
+    for (auto *root : flows->getEscapeRoots()) {
+        markEscaped(root);
+    }
+    for (auto &path : flows->getEscapedFields()) {
+        open_fields.insert(path.back());
+    }
+}
+
+void field_targets::addStoredValue(field_t field, Value *val) {
+    val = val->stripPointerCasts();
+    if (auto *f = dyn_cast<Function>(val)) {
+        targets[field].insert(f);
+    } else if (isa<ConstantPointerNull>(val) || isa<UndefValue>(val)) {
+        // Nothing is stored
+    } else if (auto *load = dyn_cast<LoadInst>(val); load && getAccessedField(load->getPointerOperand())) {
+        // Value is copied from another field
+        source_fields[field].insert(*getAccessedField(load->getPointerOperand()));
+    } else {
+        open_fields.insert(field);
+    }
+}
+
+// Escaped object may get any value in any field, including fields of embedded structs
+void field_targets::markEscaped(Type *t) {
+    if (auto *arr = dyn_cast<ArrayType>(t)) {
+        markEscaped(arr->getElementType());
+        return;
+    }
+    auto *st = dyn_cast<StructType>(t);
+    if (!st || st->isOpaque() || !escaped_types.insert(st).second) {
+        return;
+    }
+    for (auto *field : st->elements()) {
+        markEscaped(field);
+    }
+}
+
+bool field_targets::isOpen(const field_t &field) const {
+    return escaped_types.contains(field.first) || open_fields.contains(field) ||
+           flows->isOpenType(field.first->getElementType(field.second));
+}
+
+std::optional<field_targets::targets_t> field_targets::getClosedTargets(StructType *T, size_t idx) const {
+    targets_t res;
+    std::set<field_t, struct_field_less> visited = {{T, idx}};
+    std::vector<field_t> todo = {{T, idx}};
+    while (!todo.empty()) {
+        auto field = todo.back();
+        todo.pop_back();
+        if (isOpen(field)) {
+            return std::nullopt;
+        }
+        if (auto it = targets.find(field); it != targets.end()) {
+            res.insert(it->second.begin(), it->second.end());
+        }
+        if (auto *untyped = flows->getUntypedTargets(field.first->getElementType(field.second))) {
+            res.insert(untyped->begin(), untyped->end());
+        }
+        if (auto it = source_fields.find(field); it != source_fields.end()) {
+            for (auto &src : it->second) {
+                if (visited.insert(src).second) {
+                    todo.push_back(src);
+                }
+            }
+        }
+    }
+    return res;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <unordered_set>
+#include "llvm/ADT/SetVector.h"
+#include "llvm/IR/IRBuilder.h"
+#include "fptr_flows.h"
+#include "util.h"
+
+using namespace llvm;
+
+// Functions stored into struct fields: constant stores, global initializers and
+// stores of values loaded from other fields, as collected by fptr_flows.
+// Field is closed if no other value may reach it, so its targets are the only possible values.
+// Functions stored through untyped pointers are targets of every field of their type.
+// Field is open if an unknown value is stored into it, into untyped memory of its type,
+// its address escapes or the whole object escapes (see fptr_flows). Embedded structs of an escaped object escape too.
+class field_targets {
+public:
+    using targets_t = SetVector<Function*>;
+    using field_t = std::pair<StructType*, size_t>;
+
+    field_targets() = default;
+
+    explicit field_targets(Module *M);
+
+    // All functions, that may reach the field directly or through copies from other fields,
+    // in the order they were found in the module. Nothing is returned for an open field.
+    [[nodiscard]] std::optional<targets_t> getClosedTargets(StructType *T, size_t idx) const;
+private:
+    std::map<field_t, targets_t, struct_field_less> targets;
+    std::map<field_t, std::set<field_t, struct_field_less>, struct_field_less> source_fields;
+    std::set<field_t, struct_field_less> open_fields;
+    std::unordered_set<StructType*> escaped_types;
+    std::shared_ptr<const fptr_flows> flows;
+
+    // Record a value written into the field
+    void addStoredValue(field_t field, Value *val);
+
+    void markEscaped(Type *t);
+
+    [[nodiscard]] bool isOpen(const field_t &field) const;
+};
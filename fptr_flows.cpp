@@ -0,0 +1,172 @@
+#include "fptr_flows.h"
+#include "llvm/IR/IntrinsicInst.h"
+
+// Function pointers and void pointers may hold functions, other fields get them only through casts of loads
+static bool isTrackedStore(Type *field_type, Value *val) {
+    auto *field_ptr = dyn_cast<PointerType>(field_type);
+    bool byte_field = field_ptr && field_ptr->getNonOpaquePointerElementType()->isIntegerTy(8);
+    return byte_field || isFunctionPointer(field_type) || isFunctionPointer(val->getType()) ||
+           isa<Function>(val->stripPointerCasts());
+}
+
+fptr_flows::fptr_flows(Module &M) {
+    for (auto &glob : M.globals()) {
+        if (glob.hasInitializer()) {
+            field_path_t path;
+            collectConstant(glob.getInitializer(), path);
+        }
+    }
+    for (auto &f : M) {
+        for (auto &bb : f) {
+            for (auto &inst : bb) {
+                if (auto *store = dyn_cast<StoreInst>(&inst)) {
+                    collectStore(store);
+                } else if (auto *cmpxchg = dyn_cast<AtomicCmpXchgInst>(&inst)) {
+                    addEscapedAddress(cmpxchg->getPointerOperand());
+                } else if (auto *rmw = dyn_cast<AtomicRMWInst>(&inst)) {
+                    addEscapedAddress(rmw->getPointerOperand());
+                } else if (auto *memcpy = dyn_cast<MemTransferInst>(&inst)) {
+                    auto *dst_type = memcpy->getRawDest()->stripPointerCasts()->getType();
+                    auto *src_type = memcpy->getRawSource()->stripPointerCasts()->getType();
+                    if (dst_type != src_type) {
+                        addEscapeRoot(dereferenceStructPtr(dst_type));
+                    }
+                } else if (auto *cast = dyn_cast<CastInst>(&inst)) {
+                    if (isa<IntToPtrInst>(cast)) {
+                        addEscapeRoot(dereferenceStructPtr(cast->getDestTy()));
+                        continue;
+                    }
+                    auto *src_struct = dereferenceStructPtr(cast->getSrcTy());
+                    auto *dst_ptr = dyn_cast<PointerType>(cast->getDestTy());
+                    bool byte_ptr = dst_ptr && dst_ptr->getNonOpaquePointerElementType()->isIntegerTy(8);
+                    if (src_struct && !byte_ptr) {
+                        addEscapeRoot(src_struct);
+                        addEscapeRoot(dereferenceStructPtr(cast->getDestTy()));
+                    }
+                } else if (auto *call = dyn_cast<CallBase>(&inst)) {
+                    auto *callee = call->getCalledFunction();
+                    if (!callee || !callee->isDeclaration() || callee->isIntrinsic()) {
+                        continue;
+                    }
+                    // Unknown code may store passed functions anywhere and write any field of passed objects
+                    for (auto &arg : call->args()) {
+                        auto *stripped = arg->stripPointerCasts();
+                        if (auto *passed = dyn_cast<Function>(stripped)) {
+                            addUntypedTarget(passed);
+                        }
+                        addEscapeRoot(dereferenceStructPtr(arg->getType()));
+                        addEscapeRoot(dereferenceStructPtr(stripped->getType()));
+                        addEscapedAddress(arg.get());
+                    }
+                }
+            }
+        }
+    }
+}
+
+void fptr_flows::collectConstant(Constant *c, field_path_t &path) {
+    if (auto *init_struct = dyn_cast<ConstantStruct>(c)) {
+        auto *T = init_struct->getType();
+        for (size_t i = 0; i < T->getNumElements(); i++) {
+            auto *field = init_struct->getOperand(i);
+            if (T->isLiteral()) {
+                collectConstant(field, path);
+                continue;
+            }
+            path.emplace_back(T, i);
+            auto *field_type = T->getElementType(i);
+            if (field_type->isAggregateType()) {
+                collectConstant(field, path);
+            } else if (!field->isNullValue() && !isa<UndefValue>(field) && isTrackedStore(field_type, field)) {
+                field_stores.emplace_back(path, field);
+            }
+            path.pop_back();
+        }
+    } else if (isa<ConstantArray>(c) || isa<ConstantVector>(c)) {
+        for (auto &op : c->operands()) {
+            collectConstant(cast<Constant>(op.get()), path);
+        }
+    }
+}
+
+void fptr_flows::collectStore(StoreInst *store) {
+    auto *val = store->getValueOperand();
+    auto path = getAccessedFieldPath(store->getPointerOperand());
+    if (val->getType()->isAggregateType()) {
+        if (auto *c = dyn_cast<Constant>(val)) {
+            collectConstant(c, path);
+        } else {
+            addEscapeRoot(val->getType());
+        }
+        return;
+    }
+    if (!path.empty()) {
+        auto [T, idx] = path.back();
+        auto *field_type = T->getElementType(idx);
+        // A store into the first field of an embedded struct is seen as a store into the outer field
+        if (!field_type->isAggregateType()) {
+            if (isTrackedStore(field_type, val)) {
+                field_stores.emplace_back(std::move(path), val);
+            }
+            return;
+        }
+    }
+    // Locals are loaded before they reach a field
+    if (isa<AllocaInst>(store->getPointerOperand()->stripPointerCasts())) {
+        return;
+    }
+    auto *stripped = val->stripPointerCasts();
+    if (auto *f = dyn_cast<Function>(stripped)) {
+        addUntypedTarget(f);
+    } else if (isFunctionPointer(val->getType()) && !isa<ConstantPointerNull>(stripped) && !isa<UndefValue>(stripped)) {
+        open_fptr_types.insert(val->getType());
+    }
+}
+
+void fptr_flows::addEscapeRoot(Type *t) {
+    while (auto *arr = dyn_cast_or_null<ArrayType>(t)) {
+        t = arr->getElementType();
+    }
+    if (auto *st = dyn_cast_or_null<StructType>(t); st && !st->isOpaque()) {
+        escape_roots.insert(st);
+    }
+}
+
+void fptr_flows::addEscapedAddress(Value *ptr) {
+    auto path = getAccessedFieldPath(ptr);
+    if (path.empty()) {
+        return;
+    }
+    auto [T, idx] = path.back();
+    auto *field_type = T->getElementType(idx);
+    if (field_type->isAggregateType()) {
+        addEscapeRoot(field_type);
+    } else {
+        escaped_fields.push_back(std::move(path));
+    }
+}
+
+void fptr_flows::addUntypedTarget(Function *f) {
+    untyped_targets[f->getType()].insert(f);
+}
+
+const std::vector<std::pair<fptr_flows::field_path_t, Value*>> &fptr_flows::getFieldStores() const {
+    return field_stores;
+}
+
+const SetVector<Function*> *fptr_flows::getUntypedTargets(Type *fptr_type) const {
+    auto it = untyped_targets.find(fptr_type);
+    return it == untyped_targets.end() ? nullptr : &it->second;
+}
+
+bool fptr_flows::isOpenType(Type *fptr_type) const {
+    return open_fptr_types.contains(fptr_type);
+}
+
+const SetVector<StructType*> &fptr_flows::getEscapeRoots() const {
+    return escape_roots;
+}
+
+const std::vector<fptr_flows::field_path_t> &fptr_flows::getEscapedFields() const {
+    return escaped_fields;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <unordered_map>
+#include <unordered_set>
+#include "llvm/ADT/SetVector.h"
+#include "llvm/IR/IRBuilder.h"
+#include "util.h"
+
+using namespace llvm;
+
+// Ways functions reach struct fields, collected in one sweep over initializers and instructions.
+// field_targets and mlta_resolver interpret the same facts with their own precision.
+// Values are recorded, if they are functions(casts are stripped), have a function pointer type
+// or are stored into a function pointer or i8* field.
+// Escape roots are structs, that may get any value in any field:
+//   - a non-constant aggregate is stored into them
+//   - a memcpy/memmove from an object of another type
+//   - a cast to a different non-i8 pointer type or inttoptr
+//   - a pointer to them is passed to a declared function, casts are stripped
+// Escaped fields may get any value: their address is passed to a declared function or used by cmpxchg/atomicrmw.
+// An escaped field of a struct type makes that struct an escape root.
+// Consumers decide, which embedded or pointed structs escape with a root.
+class fptr_flows {
+public:
+    using field_t = std::pair<StructType*, size_t>;
+    using field_path_t = std::vector<field_t>;
+
+    explicit fptr_flows(Module &M);
+
+    // Values stored into known fields with the whole path, outer struct first. Initializers are included
+    [[nodiscard]] const std::vector<std::pair<field_path_t, Value*>>& getFieldStores() const;
+
+    // Functions stored through untyped or non-field pointers or passed to declared functions,
+    // they may reach any field of their pointer type
+    [[nodiscard]] const SetVector<Function*>* getUntypedTargets(Type *fptr_type) const;
+
+    // Function pointer types, that got unknown values through untyped memory
+    [[nodiscard]] bool isOpenType(Type *fptr_type) const;
+
+    [[nodiscard]] const SetVector<StructType*>& getEscapeRoots() const;
+
+    // Paths of escaped non-aggregate fields, outer struct first
+    [[nodiscard]] const std::vector<field_path_t>& getEscapedFields() const;
+private:
+    std::vector<std::pair<field_path_t, Value*>> field_stores;
+    std::unordered_map<Type*, SetVector<Function*>> untyped_targets;
+    std::unordered_set<Type*> open_fptr_types;
+    SetVector<StructType*> escape_roots;
+    std::vector<field_path_t> escaped_fields;
+
+    // Nested aggregates add a layer, arrays don't
+    void collectConstant(Constant *c, field_path_t &path);
+
+    void collectStore(StoreInst *store);
+
+    void addEscapeRoot(Type *t);
+
+    // Value written through the pointer is unknown
+    void addEscapedAddress(Value *ptr);
+
+    void addUntypedTarget(Function *f);
+};
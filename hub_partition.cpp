@@ -0,0 +1,90 @@
+#include "hub_partition.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/xxhash.h"
+
+hub_partitioner::hub_partitioner(Module *M, struct_filter &type_tracker, size_t partitions, size_t min_fanin,
+                                 partition_key key): partitions(std::max<size_t>(partitions, 1)), key(key) {
+    if (this->partitions == 1) {
+        return;
+    }
+    findHubs(*M, type_tracker, min_fanin);
+    if (!hubs.empty()) {
+        assignPartitions(*M);
+    }
+}
+
+// Fan-in of a type is the number of functions and globals, that mention it
+void hub_partitioner::findHubs(Module &M, struct_filter &type_tracker, size_t min_fanin) {
+    std::unordered_map<StructType*, size_t> fanin;
+    for (auto &f : M) {
+        std::unordered_set<StructType*> used;
+        used.insert(getStructType(f.getReturnType()));
+        for (auto *arg : f.getFunctionType()->params()) {
+            used.insert(getStructType(arg));
+        }
+        struct_filter::collectUsedStructs(f, used);
+        for (auto *s : used) {
+            if (s && type_tracker.isInterestingType(s)) {
+                fanin[s]++;
+            }
+        }
+    }
+    for (auto &glob : M.getGlobalList()) {
+        Type *t = glob.getValueType();
+        while (auto *arr = dyn_cast<ArrayType>(t)) {
+            t = arr->getElementType();
+        }
+        if (type_tracker.isInterestingType(t)) {
+            fanin[dyn_cast<StructType>(t)]++;
+        }
+    }
+    for (auto &[type, users] : fanin) {
+        if (users >= min_fanin) {
+            hubs.insert(type);
+        }
+    }
+    outs() << "Hub types: " << hubs.size() << "\n";
+    for (auto *hub : hubs) {
+        outs() << "  " << hub->getName() << ": " << fanin[hub] << " users\n";
+    }
+    outs().flush();
+}
+
+void hub_partitioner::assignPartitions(Module &M) {
+    for (auto &f : M) {
+        if (auto path = getSourcePath(&f)) {
+            site_partitions[&f] = partitionOfPath(*path);
+        }
+    }
+    for (auto &glob : M.getGlobalList()) {
+        if (auto path = getSourcePath(&glob)) {
+            site_partitions[&glob] = partitionOfPath(*path);
+        }
+    }
+}
+
+size_t hub_partitioner::partitionOfPath(StringRef path) const {
+    if (key == partition_key::directory) {
+        path = sys::path::parent_path(path);
+    }
+    return xxHash64(path) % partitions;
+}
+
+bool hub_partitioner::isHub(StructType *T) const {
+    return hubs.contains(T);
+}
+
+size_t hub_partitioner::getPartitionCount() const {
+    return partitions;
+}
+
+size_t hub_partitioner::getPartition(const GlobalValue *site) const {
+    if (auto it = site_partitions.find(site); it != site_partitions.end()) {
+        return it->second;
+    }
+    return 0;
+}
+
+const std::set<StructType*, struct_name_less> &hub_partitioner::getHubs() const {
+    return hubs;
+}
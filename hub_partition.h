@@ -0,0 +1,46 @@
+#pragma once
+
+#include <unordered_map>
+#include <unordered_set>
+#include "llvm/IR/IRBuilder.h"
+#include "struct_filter.h"
+
+using namespace llvm;
+
+enum class partition_key {
+    file,
+    directory,
+};
+
+// Interesting types used by many functions and globals(ops tables and similar) are hubs:
+// merging all their objects into one singleton makes points-to sets explode.
+// Hubs get a singleton per partition, code and data are routed to a partition by the source
+// file or directory from debug info. Everything without debug info goes to partition 0.
+class hub_partitioner {
+public:
+    hub_partitioner() = default;
+
+    // Type is a hub if at least min_fanin functions and globals use it
+    hub_partitioner(Module *M, struct_filter &type_tracker, size_t partitions, size_t min_fanin, partition_key key);
+
+    [[nodiscard]] bool isHub(StructType *T) const;
+
+    [[nodiscard]] size_t getPartitionCount() const;
+
+    // Partition of a function or a global variable, stable between runs
+    [[nodiscard]] size_t getPartition(const GlobalValue *site) const;
+
+    // Hubs ordered by name
+    [[nodiscard]] const std::set<StructType*, struct_name_less>& getHubs() const;
+private:
+    size_t partitions = 1;
+    partition_key key = partition_key::file;
+    std::set<StructType*, struct_name_less> hubs;
+    std::unordered_map<const GlobalValue*, size_t> site_partitions;
+
+    void findHubs(Module &M, struct_filter &type_tracker, size_t min_fanin);
+
+    void assignPartitions(Module &M);
+
+    [[nodiscard]] size_t partitionOfPath(StringRef path) const;
+};
@@ -0,0 +1,217 @@
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "instr_server.h"
+#include "instrument_ir.h"
+
+// Config files are read once, errors in them stop the server before it starts listening
+instr_server::instr_server():
+        ctx(std::make_unique<LLVMContext>()), policy(loadTypePolicy()), externs(loadExternSpec()) {}
+
+std::string instr_server::handle(StringRef request, bool &quit) {
+    auto [command, arg] = request.trim().split(' ');
+    arg = arg.trim();
+    if (command == "QUIT") {
+        quit = true;
+        return "OK";
+    }
+    if (command == "STATS") {
+        return stats();
+    }
+    if (command != "LOAD" && command != "UPDATE" && command != "INSTRUMENT") {
+        return "ERROR unknown request " + command.str();
+    }
+    if (arg.empty()) {
+        return "ERROR " + command.str() + " needs a file";
+    }
+    if (command == "LOAD") {
+        return load(arg.str());
+    }
+    if (!pristine) {
+        return "ERROR no module is loaded";
+    }
+    return command == "UPDATE" ? update(arg.str()) : instrument(arg.str());
+}
+
+std::string instr_server::load(const std::string &path) {
+    // Types live as long as their context, a fresh one keeps struct names of the new module without suffixes
+    auto new_ctx = std::make_unique<LLVMContext>();
+    SMDiagnostic err;
+    auto M = parseIRFile(path, err, *new_ctx);
+    if (!M) {
+        return "ERROR cannot parse " + path + ": " + err.getMessage().str();
+    }
+    types.reset();
+    pristine.reset();
+    ctx = std::move(new_ctx);
+    pristine = std::move(M);
+    updates = 0;
+    return stats();
+}
+
+std::string instr_server::update(const std::string &path) {
+    SMDiagnostic err;
+    auto changed = parseIRFile(path, err, *ctx);
+    if (!changed) {
+        return "ERROR cannot parse " + path + ": " + err.getMessage().str();
+    }
+    // Linker renames local symbols instead of replacing them, so static definitions of recompiled files are
+    // linked as external ones and made local again. Same named statics of different files are not distinguished.
+    std::vector<std::string> local_names;
+    size_t definitions = 0;
+    for (auto &gv : changed->global_values()) {
+        if (gv.isDeclaration()) {
+            continue;
+        }
+        definitions++;
+        auto *old = pristine->getNamedValue(gv.getName());
+        if (gv.hasLocalLinkage() && old && old->hasLocalLinkage()) {
+            old->setLinkage(GlobalValue::ExternalLinkage);
+            gv.setLinkage(GlobalValue::ExternalLinkage);
+            local_names.push_back(gv.getName().str());
+        }
+    }
+    types.reset();
+    // Definitions of the update replace the current ones, its types are mapped to the current types
+    if (Linker::linkModules(*pristine, std::move(changed), Linker::Flags::OverrideFromSrc)) {
+        return "ERROR cannot link " + path;
+    }
+    for (auto &name : local_names) {
+        if (auto *gv = pristine->getNamedValue(name)) {
+            gv->setLinkage(GlobalValue::InternalLinkage);
+        }
+    }
+    updates++;
+    return "OK replaced=" + std::to_string(definitions);
+}
+
+std::string instr_server::instrument(const std::string &path) {
+    auto start = std::chrono::steady_clock::now();
+    if (!types) {
+        types.emplace(pristine.get(), policy ? &*policy : nullptr);
+    }
+    // Types of the clone are the same, so the filter is valid for it
+    auto M = CloneModule(*pristine);
+    std::string error;
+    legacy::PassManager PM;
+    PM.add(createStructVisitorPass(&*types, externs ? &*externs : nullptr, &error));
+    PM.run(*M);
+    if (!error.empty()) {
+        return "ERROR " + error;
+    }
+
+    std::error_code ec;
+    ToolOutputFile out(path, ec, sys::fs::OF_None);
+    if (ec) {
+        return "ERROR cannot open " + path + ": " + ec.message();
+    }
+    WriteBitcodeToFile(*M, out.os());
+    out.keep();
+    runs++;
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    std::string reply;
+    raw_string_ostream os(reply);
+    os << "OK " << path << " instructions=" << pristine->getInstructionCount() << "->" << M->getInstructionCount();
+    os << " interesting=" << types->getInterestingTypes().size() << " ms=" << elapsed.count();
+    return os.str();
+}
+
+std::string instr_server::stats() {
+    if (!pristine) {
+        return "ERROR no module is loaded";
+    }
+    size_t definitions = std::ranges::count_if(*pristine, [](Function &f) { return !f.isDeclaration(); });
+    std::string reply;
+    raw_string_ostream os(reply);
+    os << "OK module=" << pristine->getModuleIdentifier() << " functions=" << pristine->size();
+    os << " definitions=" << definitions << " globals=" << pristine->global_size();
+    os << " instructions=" << pristine->getInstructionCount() << " updates=" << updates << " runs=" << runs;
+    return os.str();
+}
+
+static void sendAll(int fd, const std::string &data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        // Client may be gone, it must not kill the server
+        auto n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return;
+        }
+        sent += n;
+    }
+}
+
+int instr_server::serve(const std::string &socket_path) {
+    sockaddr_un addr{};
+    if (socket_path.size() >= sizeof(addr.sun_path)) {
+        errs() << "Socket path is too long: " << socket_path << "\n";
+        return 1;
+    }
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+
+    // Socket file of a previous server is removed, any other file is kept
+    struct stat st{};
+    if (lstat(socket_path.c_str(), &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            errs() << "Cannot listen on " << socket_path << ": file exists and is not a socket\n";
+            return 1;
+        }
+        unlink(socket_path.c_str());
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || listen(fd, 4) < 0) {
+        errs() << "Cannot listen on " << socket_path << ": " << std::strerror(errno) << "\n";
+        if (fd >= 0) {
+            close(fd);
+        }
+        return 1;
+    }
+    outs() << "Listening on " << socket_path << "\n";
+    outs().flush();
+
+    bool quit = false;
+    while (!quit) {
+        int client = accept(fd, nullptr, nullptr);
+        if (client < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            errs() << "Cannot accept a client: " << std::strerror(errno) << "\n";
+            break;
+        }
+        std::string buffer;
+        char chunk[4096];
+        ssize_t n;
+        while (!quit && (n = read(client, chunk, sizeof(chunk))) > 0) {
+            buffer.append(chunk, n);
+            size_t eol;
+            while (!quit && (eol = buffer.find('\n')) != std::string::npos) {
+                auto reply = handle(StringRef(buffer).take_front(eol), quit);
+                buffer.erase(0, eol + 1);
+                outs().flush();
+                sendAll(client, reply + "\n");
+            }
+        }
+        close(client);
+    }
+    close(fd);
+    unlink(socket_path.c_str());
+    return 0;
+}
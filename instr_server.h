@@ -0,0 +1,47 @@
+#pragma once
+
+#include <memory>
+#include <optional>
+#include <string>
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "extern_spec.h"
+#include "struct_filter.h"
+#include "type_policy.h"
+
+using namespace llvm;
+
+// Keeps a pristine module and the filter of its types in memory, copies of the module are instrumented on request.
+// Every request is one line, every reply is one line, that starts with OK or ERROR:
+//   LOAD <file>          parse a module, it replaces the current one
+//   UPDATE <file>        link a module with changed definitions(e.g. recompiled files) over the current one
+//   INSTRUMENT <file>    instrument a copy of the current module and write its bitcode to the file
+//   STATS                sizes of the current module
+//   QUIT                 stop the server
+class instr_server {
+public:
+    instr_server();
+
+    // Reply to the request, quit is set if the server must stop
+    std::string handle(StringRef request, bool &quit);
+
+    // Serve clients one by one over a Unix socket until QUIT is received, return the exit code
+    int serve(const std::string &socket_path);
+private:
+    std::unique_ptr<LLVMContext> ctx;
+    std::unique_ptr<Module> pristine;
+    std::optional<type_policy> policy;
+    std::optional<extern_spec> externs;
+    // Rebuilt on the first instrumentation after the module is changed
+    std::optional<struct_filter> types;
+    size_t updates = 0;
+    size_t runs = 0;
+
+    std::string load(const std::string &path);
+
+    std::string update(const std::string &path);
+
+    std::string instrument(const std::string &path);
+
+    std::string stats();
+};
@@ -0,0 +1,188 @@
+// Standalone driver for the instrumentation pass
+// In lazy mode with -summarize-bodies the module is scanned in chunks in a scratch context first. Bodies in scope,
+// that never touch interesting types, are summarized right after they are loaded, so only relevant bodies are kept
+// in memory.
+// In server mode modules are kept in memory and instrumented on requests from a Unix socket.
+#include <unordered_set>
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "body_summary.h"
+#include "instr_server.h"
+#include "instrument_ir.h"
+#include "struct_filter.h"
+
+using namespace llvm;
+
+static cl::opt<std::string> InputFile(cl::Positional, cl::desc("<input bitcode>"));
+
+static cl::opt<std::string> OutputFile(
+        "o", cl::desc("Output bitcode file"), cl::value_desc("filename")
+);
+
+static cl::opt<std::string> ServeSocket(
+        "serve", cl::desc("Serve instrumentation requests on the Unix socket, input is loaded first if given"),
+        cl::value_desc("socket path")
+);
+
+static cl::opt<bool> LazyLoad(
+        "lazy", cl::desc("Load only function bodies, that may touch interesting types"), cl::init(false)
+);
+
+static cl::opt<unsigned> ChunkSize(
+        "chunk-size", cl::desc("Number of function bodies scanned at once in lazy mode"), cl::init(1024)
+);
+
+static std::unique_ptr<Module> loadModule(LLVMContext &ctx, bool lazy) {
+    SMDiagnostic err;
+    auto M = lazy ? getLazyIRFileModule(InputFile, err, ctx) : parseIRFile(InputFile, err, ctx);
+    if (!M) {
+        err.print("ptr-instr", errs());
+        exit(1);
+    }
+    return M;
+}
+
+static void materialize(Function &f) {
+    if (auto err = f.materialize()) {
+        errs() << "Cannot materialize " << f.getName() << ": " << toString(std::move(err)) << "\n";
+        exit(1);
+    }
+}
+
+// Body can be dropped only if nothing refers to its blocks
+static bool canDeleteBody(Function &f) {
+    return std::ranges::none_of(f, [](BasicBlock &bb) { return bb.hasAddressTaken(); });
+}
+
+// Scan all bodies in a scratch context, deleting every chunk after it is scanned
+// Return names of functions in scope, that can be summarized
+static std::unordered_set<std::string> findSummarizableLazily() {
+    LLVMContext ctx;
+    auto M = loadModule(ctx, true);
+
+    std::unordered_set<std::string> defined;
+    for (auto &f : *M) {
+        if (!f.isDeclaration() && f.hasName()) {
+            defined.insert(f.getName().str());
+        }
+    }
+
+    unloaded_body_types unloaded;
+    // Debug info of a body is available only while it is loaded
+    auto scope = loadSourceScope();
+    std::unordered_set<std::string> out_of_scope;
+    std::vector<std::pair<std::string, body_facts>> facts;
+    std::vector<Function*> chunk;
+    size_t scanned = 0;
+    auto scanChunk = [&]() {
+        if (chunk.empty()) {
+            return;
+        }
+        for (auto *f : chunk) {
+            struct_filter::collectIdentifiedStructs(*f, unloaded.identified);
+            struct_filter::collectUsedStructs(*f, unloaded.used);
+            if (f->hasName()) {
+                facts.emplace_back(f->getName().str(), collectBodyFacts(*f, &defined));
+                if (!scope.contains(f)) {
+                    out_of_scope.insert(f->getName().str());
+                }
+            }
+            if (canDeleteBody(*f)) {
+                f->deleteBody();
+            }
+        }
+        scanned += chunk.size();
+        chunk.clear();
+        outs() << "Scanned " << scanned << " functions\n";
+        outs().flush();
+    };
+    for (auto &f : *M) {
+        if (f.isDeclaration()) {
+            continue;
+        }
+        materialize(f);
+        chunk.push_back(&f);
+        if (chunk.size() >= ChunkSize) {
+            scanChunk();
+        }
+    }
+    scanChunk();
+
+    auto policy = loadTypePolicy();
+    struct_filter type_tracker(M.get(), policy ? &*policy : nullptr, &unloaded);
+    body_summarizer summarizer(type_tracker);
+    for (auto &[name, f_facts] : facts) {
+        summarizer.addFunction(name, std::move(f_facts));
+    }
+    auto summarizable = summarizer.findSummarizable();
+    for (auto &name : out_of_scope) {
+        summarizable.erase(name);
+    }
+    return summarizable;
+}
+
+int main(int argc, char **argv) {
+    InitLLVM X(argc, argv);
+    cl::ParseCommandLineOptions(argc, argv, "LLVM IR instrumentation for pointer analysis\n");
+
+    if (!ServeSocket.empty()) {
+        instr_server server;
+        if (!InputFile.empty()) {
+            bool quit = false;
+            auto reply = server.handle("LOAD " + InputFile.getValue(), quit);
+            outs() << reply << "\n";
+            outs().flush();
+        }
+        return server.serve(ServeSocket.getValue());
+    }
+    if (InputFile.empty() || OutputFile.empty()) {
+        errs() << "Input file and -o are required\n";
+        return 1;
+    }
+
+    // Without summaries every body is needed anyway
+    std::unordered_set<std::string> summarizable;
+    if (LazyLoad.getValue() && isSummarizationEnabled()) {
+        summarizable = findSummarizableLazily();
+        outs() << "Functions to summarize: " << summarizable.size() << "\n";
+        outs().flush();
+    }
+
+    LLVMContext ctx;
+    auto M = loadModule(ctx, LazyLoad.getValue());
+    if (LazyLoad.getValue()) {
+        for (auto &f : *M) {
+            if (f.hasName() && summarizable.contains(f.getName().str())) {
+                // Subprogram of the function is loaded with its body, the body is dropped right away
+                materialize(f);
+                body_summarizer::summarizeFunction(&f);
+            }
+        }
+        if (auto err = M->materializeAll()) {
+            errs() << "Cannot materialize module: " << toString(std::move(err)) << "\n";
+            return 1;
+        }
+    }
+
+    legacy::PassManager PM;
+    PM.add(createStructVisitorPass());
+    PM.run(*M);
+
+    std::error_code ec;
+    ToolOutputFile out(OutputFile, ec, sys::fs::OF_None);
+    if (ec) {
+        errs() << "Cannot open " << OutputFile << ": " << ec.message() << "\n";
+        return 1;
+    }
+    WriteBitcodeToFile(*M, out.os());
+    out.keep();
+    return 0;
+}
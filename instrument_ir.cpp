@@ -1,12 +1,25 @@
 #include <map>
 #include "llvm/Pass.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/DebugInfo.h"
+#include "llvm/IR/IntrinsicInst.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/ValueMap.h"
 #include "llvm/Transforms/IPO/PassManagerBuilder.h"
+#include "llvm/Transforms/Utils/Local.h"
 #include "llvm/Support/CommandLine.h"
 #include "util.h"
+#include "instrument_ir.h"
 #include "struct_filter.h"
+#include "sidecar_index.h"
+#include "ir_metrics.h"
+#include "field_targets.h"
+#include "body_summary.h"
+#include "hub_partition.h"
+#include "source_scope.h"
+#include "extern_spec.h"
+#include "debug_map.h"
 
 using namespace llvm;
 
@@ -20,6 +33,18 @@ static cl::opt<bool> ReplaceBitcasts(
         "repl-bitcasts", cl::desc("Replace suspicious bitcasts"), cl::init(true)
 );
 
+static cl::opt<bool> MapByteGEPs(
+        "map-byte-geps",
+        cl::desc("Replace constant byte offset GEPs from struct pointers with field GEPs"),
+        cl::init(false)
+);
+
+static cl::opt<bool> Cleanup(
+        "cleanup",
+        cl::desc("Erase rewritten instructions with their dead operands, unreferenced singletons and stubs"),
+        cl::init(false)
+);
+
 static cl::opt<bool> CopyFromGlobals(
         "copy-globals", cl::desc("Copy global values to singletons"), cl::init(true)
 );
@@ -34,20 +59,265 @@ static cl::opt<bool> ImplementExternal(
         "impl-extern", cl::desc("Implement external functions"), cl::init(true)
 );
 
-std::string funcStubName(const std::string &struct_name, size_t idx) {
-    return PREFIX + "_" + struct_name + "_" + std::to_string(idx) + "_stub";
+static cl::opt<bool> SummarizeBodies(
+        "summarize-bodies",
+        cl::desc("Replace bodies of functions, that never touch interesting types, with trivial summaries"),
+        cl::init(false)
+);
+
+static cl::opt<std::string> IndexOutput(
+        "index-out",
+        cl::desc("Write a binary index of singletons, stubs and indirect call sites to this file"),
+        cl::init("")
+);
+
+static cl::opt<std::string> DebugMapOutput(
+        "debug-map-out",
+        cl::desc("Write source locations of functions, indirect calls and stores to this file and strip debug info"),
+        cl::init("")
+);
+
+static cl::opt<std::string> TypePolicy(
+        "type-policy",
+        cl::desc("File with allow/deny lists and size limits for interesting types"),
+        cl::init("")
+);
+
+static cl::opt<bool> ReportMetrics(
+        "report-metrics",
+        cl::desc("Report IR growth and estimated constraints after every phase"),
+        cl::init(false)
+);
+
+static cl::opt<bool> DevirtualizeStubs(
+        "devirt-stubs",
+        cl::desc("Call known targets directly from stubs of fields, that get only constant functions"),
+        cl::init(false)
+);
+
+static cl::opt<bool> DryRun(
+        "dry-run",
+        cl::desc("Only report what would be created and replaced, the module is not changed"),
+        cl::init(false)
+);
+
+static cl::opt<uint64_t> BudgetInsts(
+        "budget-insts",
+        cl::desc("Maximal number of instructions in generated stubs, dummy calls and global copies, 0 is unlimited"),
+        cl::init(0)
+);
+
+static cl::opt<uint64_t> BudgetCalls(
+        "budget-calls", cl::desc("Maximal number of dummy calls, 0 is unlimited"), cl::init(0)
+);
+
+static cl::opt<uint64_t> BudgetCopyBytes(
+        "budget-copy-bytes",
+        cl::desc("Maximal number of bytes copied by dummy calls and global copies, 0 is unlimited"),
+        cl::init(0)
+);
+
+static cl::opt<bool> CallStubs(
+        "call-stubs",
+        cl::desc("Call field stubs instead of function pointers loaded from interesting fields"),
+        cl::init(false)
+);
+
+static cl::opt<unsigned> HubPartitions(
+        "hub-partitions",
+        cl::desc("Split singletons of hub types into this many partitions, 1 keeps one object per type"),
+        cl::init(1)
+);
+
+static cl::opt<unsigned> HubFanin(
+        "hub-fanin",
+        cl::desc("Minimal number of functions and globals using a type to make it a hub"),
+        cl::init(64)
+);
+
+static cl::opt<partition_key> HubPartitionKey(
+        "hub-partition-key",
+        cl::desc("Debug info location, that selects the partition of hub objects"),
+        cl::values(
+                clEnumValN(partition_key::file, "file", "Source file"),
+                clEnumValN(partition_key::directory, "dir", "Source directory")
+        ),
+        cl::init(partition_key::file)
+);
+
+static cl::list<std::string> RegisterFunctions(
+        "register-functions",
+        cl::desc("Functions, that make passed callbacks callable from outside"),
+        cl::CommaSeparated
+);
+
+static cl::list<std::string> ScopeInclude(
+        "scope-include",
+        cl::desc("Instrument only functions and globals from source paths matching these patterns"),
+        cl::CommaSeparated
+);
+
+static cl::list<std::string> ScopeExclude(
+        "scope-exclude",
+        cl::desc("Do not instrument functions and globals from source paths matching these patterns"),
+        cl::CommaSeparated
+);
+
+static cl::opt<std::string> ExternSpec(
+        "extern-spec",
+        cl::desc("File with models of external functions, used instead of default bodies"),
+        cl::init("")
+);
+
+// Used together with -register-functions
+static const std::unordered_set<std::string> DEFAULT_REGISTER_FUNCTIONS = {
+        "request_irq",
+        "request_threaded_irq",
+        "kthread_create_on_node",
+        "kthread_run",
+        "call_rcu",
+        "atexit",
+        "pthread_create",
+        "signal",
+};
+
+// Partition 0 is the main object and has no suffix
+std::string partitionSuffix(size_t partition) {
+    return partition == 0 ? "" : "_p" + std::to_string(partition);
+}
+
+std::string funcStubName(const std::string &struct_name, size_t idx, size_t partition = 0) {
+    return PREFIX + "_" + struct_name + "_" + std::to_string(idx) + "_stub" + partitionSuffix(partition);
+}
+
+std::string syncFuncName(const std::string &struct_name, size_t partition = 0) {
+    return PREFIX + "_" + struct_name + "_sync" + partitionSuffix(partition);
 }
 
-std::string structSingletonName(const std::string &struct_name) {
-    return PREFIX + "_" + struct_name + "_singleton";
+std::string declarationCopyName(const std::string &function_name, size_t partition) {
+    return PREFIX + "_" + function_name + partitionSuffix(partition);
 }
 
+// Keys of input instructions are dropped with them and never move to replacements
+struct input_index_config : ValueMapConfig<const Instruction*> {
+    enum { FollowRAUW = false };
+};
+
+std::string structSingletonName(const std::string &struct_name, size_t partition = 0) {
+    return PREFIX + "_" + struct_name + "_singleton" + partitionSuffix(partition);
+}
+
+// Expected changes of one phase in a dry run, in total and by interesting type
+struct phase_estimate {
+    size_t count = 0;
+    uint64_t memcpy_bytes = 0;
+    std::map<StructType*, std::pair<size_t, uint64_t>, struct_name_less> per_type;
+
+    void add(size_t n, uint64_t bytes = 0) {
+        count += n;
+        memcpy_bytes += bytes;
+    }
+
+    // Per type numbers are not added to the total, one item may involve several types
+    void addType(StructType *T, size_t n, uint64_t bytes = 0) {
+        auto &[type_count, type_bytes] = per_type[T];
+        type_count += n;
+        type_bytes += bytes;
+    }
+
+    void print(raw_ostream &out, const std::string &phase) const {
+        out << "[dry-run] " << phase << ": " << count;
+        if (memcpy_bytes) {
+            out << ", memcpy bytes " << memcpy_bytes;
+        }
+        out << "\n";
+        for (auto &[type, stats] : per_type) {
+            out << "[dry-run]     " << type->getName() << ": " << stats.first;
+            if (stats.second) {
+                out << ", memcpy bytes " << stats.second;
+            }
+            out << "\n";
+        }
+    }
+};
+
+// Caps on generated work, zero means no limit
+struct work_budget {
+    uint64_t insts = 0;
+    uint64_t calls = 0;
+    uint64_t copy_bytes = 0;
+
+    uint64_t used_insts = 0;
+    uint64_t used_calls = 0;
+    uint64_t used_copy_bytes = 0;
+
+    [[nodiscard]] bool isLimited() const {
+        return insts || calls || copy_bytes;
+    }
+
+    // Use the budget if the cost fits into every cap
+    bool take(uint64_t cost_insts, uint64_t cost_calls, uint64_t cost_bytes) {
+        auto fits = [](uint64_t cap, uint64_t used, uint64_t cost) {
+            return cap == 0 || used + cost <= cap;
+        };
+        if (!fits(insts, used_insts, cost_insts) || !fits(calls, used_calls, cost_calls) ||
+                !fits(copy_bytes, used_copy_bytes, cost_bytes)) {
+            return false;
+        }
+        used_insts += cost_insts;
+        used_calls += cost_calls;
+        used_copy_bytes += cost_bytes;
+        return true;
+    }
+};
+
 struct StructVisitorPass : public ModulePass {
-    StructVisitorPass(): ModulePass(ID) {}
+    explicit StructVisitorPass(const struct_filter *types = nullptr, const extern_spec *externs = nullptr,
+                               std::string *error = nullptr):
+            ModulePass(ID), prebuilt_types(types), prebuilt_externs(externs), error_out(error) {}
 
     bool runOnModule(Module &M) override {
-        type_tracker = struct_filter(&M);
+        if (prebuilt_types) {
+            type_tracker = *prebuilt_types;
+        } else {
+            auto policy = loadTypePolicy();
+            type_tracker = struct_filter(&M, policy ? &*policy : nullptr);
+        }
         outs().flush();
+        hubs = hub_partitioner(&M, type_tracker, HubPartitions.getValue(), HubFanin.getValue(),
+                               HubPartitionKey.getValue());
+        if (prebuilt_externs) {
+            extern_models = *prebuilt_externs;
+        } else if (!ExternSpec.empty()) {
+            extern_models = extern_spec::fromFile(ExternSpec.getValue());
+        }
+        // Types are still discovered in the whole module
+        scope = loadSourceScope();
+
+        if (DevirtualizeStubs.getValue()) {
+            // Collect stored functions before any instrumentation is added
+            stored_functions = field_targets(&M);
+        }
+
+        // Dropped candidates are left out of the estimate as well
+        planWorkBudget(M);
+
+        if (DryRun.getValue()) {
+            estimateInstrumentation(M);
+            clearState();
+            return false;
+        }
+
+        if (!IndexOutput.empty() || !DebugMapOutput.empty()) {
+            // Rewrites add and erase instructions, keys refer to the input like -mlta-out and traces
+            recordInputIndex(M);
+        }
+
+        metrics_collector initial_metrics(&type_tracker), last_metrics(&type_tracker);
+        if (ReportMetrics.getValue()) {
+            initial_metrics.collect(M);
+            last_metrics = initial_metrics;
+        }
 
         createGlobalInitializer(M);
         createFunctionCaller(M);
@@ -62,45 +332,95 @@ struct StructVisitorPass : public ModulePass {
         fillSingletons(M);
         outs() << "Singletons filled\n";
         outs().flush();
+        reportPhaseMetrics(M, "singletons", last_metrics);
+
+        if (MapByteGEPs.getValue()) {
+            size_t mapped = mapAllByteGEPs(M);
+            outs() << "Byte offset GEPs mapped: " << mapped << "\n";
+            outs().flush();
+            reportPhaseMetrics(M, "byte GEPs", last_metrics);
+        }
 
         if (RemoveNegativeGEPs.getValue()) {
             size_t replaced = replaceAllNegativeGEPs(M);
             outs() << "Negative GEPs replaced: " << replaced << "\n";
             outs().flush();
+            reportPhaseMetrics(M, "negative GEPs", last_metrics);
         }
 
         if (ReplaceBitcasts.getValue()) {
             replaceRestrictedCasts(M);
             outs() << "Casts replaced\n";
             outs().flush();
+            reportPhaseMetrics(M, "bitcasts", last_metrics);
+        }
+
+        if (CallStubs.getValue()) {
+            size_t replaced = replaceIndirectCalls(M);
+            outs() << "Indirect calls replaced: " << replaced << "\n";
+            outs().flush();
+            reportPhaseMetrics(M, "stub calls", last_metrics);
         }
 
         if (CopyFromGlobals.getValue()) {
             detectAllGlobals(M);
             outs() << "Globals resolved\n";
             outs().flush();
+            reportPhaseMetrics(M, "globals", last_metrics);
         }
 
         if (CallFunctions.getValue()) {
             propagateSingletons(M);
             outs() << "Singletons pushed\n";
             outs().flush();
+            reportPhaseMetrics(M, "dummy calls", last_metrics);
         }
 
         if (ImplementExternal.getValue()) {
             // FIXME: explore ext4 module to see what's going on
             implementAllInterestingDeclarations(M);
+            if (hasFailed()) {
+                clearState();
+                return true;
+            }
             outs() << "Functions implemented\n";
             outs().flush();
+            reportPhaseMetrics(M, "declarations", last_metrics);
+        }
+
+        if (SummarizeBodies.getValue()) {
+            size_t summarized = summarizeIrrelevantBodies(M);
+            outs() << "Function bodies summarized: " << summarized << "\n";
+            outs().flush();
+            reportPhaseMetrics(M, "summaries", last_metrics);
         }
 
         removeDivOperator(M);
 
+        if (Cleanup.getValue()) {
+            removeDeadResidue(M);
+            reportPhaseMetrics(M, "cleanup", last_metrics);
+        }
+
         finalizeGlobalInitializer(M);
         finalizeFunctionCaller(M);
+        reportPhaseMetrics(M, "finalization", last_metrics);
+        reportPhaseMetrics(M, "total", initial_metrics);
 
-        // Clean type_tracker
-        type_tracker = struct_filter();
+        if (!IndexOutput.empty()) {
+            writeSidecarIndex(M, IndexOutput.getValue());
+            outs() << "Index written\n";
+            outs().flush();
+        }
+
+        if (!DebugMapOutput.empty()) {
+            writeDebugMap(M, DebugMapOutput.getValue());
+            StripDebugInfo(M);
+            outs() << "Debug info stripped\n";
+            outs().flush();
+        }
+
+        clearState();
         return true;
     }
 
@@ -108,12 +428,45 @@ struct StructVisitorPass : public ModulePass {
 private:
     // Interesting types
     struct_filter type_tracker;
+    // filter of the same types, built before the pass, e.g. by the server
+    const struct_filter *prebuilt_types = nullptr;
+    // parsed -extern-spec, given by the server
+    const extern_spec *prebuilt_externs = nullptr;
+    // failures are reported here instead of exiting, the server keeps running
+    std::string *error_out = nullptr;
+    // next address, that replaces a negative GEP
+    int64_t negative_gep_addr = 1024;
     // data consumer objects for interesting types
     std::unordered_map<StructType*, GlobalVariable*> singletons;
-    // field stubs
-    std::map<std::pair<StructType*, size_t>, Function*> function_stubs;
+    // field stubs, ordered by struct name and field index
+    std::map<std::pair<StructType*, size_t>, Function*, struct_field_less> function_stubs;
+    // hub types and partitions of their users
+    hub_partitioner hubs;
+    // singletons of every hub partition, the main singleton is the first one
+    std::unordered_map<StructType*, std::vector<GlobalVariable*>> hub_singletons;
+    // field stubs of every hub partition
+    std::map<std::pair<StructType*, size_t>, std::vector<Function*>, struct_field_less> hub_stubs;
+    // field of every stub, calls of stubs are indirect calls of these fields
+    std::unordered_map<Function*, std::pair<StructType*, size_t>> stub_fields;
+    // stubs, dummy call targets and copied globals, that don't fit into the work budget
+    std::set<std::pair<StructType*, size_t>, struct_field_less> dropped_stubs;
+    std::unordered_set<const GlobalValue*> dropped_work;
+    // helpers, that copy an object to the singleton of its type(and partition) and back
+    std::map<std::pair<StructType*, size_t>, Function*, struct_field_less> sync_functions;
+    // positions of instructions in the input bodies, keys of the sidecar index and the debug map
+    ValueMap<const Instruction*, uint32_t, input_index_config> input_index;
     // all added functions
     std::set<Function*> new_functions;
+    // all added globals
+    std::unordered_set<GlobalVariable*> new_globals;
+    // instructions, that lost their uses after rewrites, they are erased by the cleanup
+    SmallVector<WeakTrackingVH, 0> rewritten;
+    // functions and globals, that are instrumented
+    source_scope scope;
+    // models of declared functions
+    extern_spec extern_models;
+    // functions stored into struct fields, used for stub devirtualization
+    field_targets stored_functions;
 
     // Singletons initializer
     Function* global_initializer = nullptr;
@@ -125,6 +478,505 @@ private:
     // Function caller block
     BasicBlock* functions_caller_bb = nullptr;
 
+    void clearState() {
+        // Clean type_tracker
+        type_tracker = struct_filter();
+        stored_functions = field_targets();
+        hubs = hub_partitioner();
+        hub_singletons.clear();
+        hub_stubs.clear();
+        stub_fields.clear();
+        scope = source_scope();
+        extern_models = extern_spec();
+        dropped_stubs.clear();
+        dropped_work.clear();
+        sync_functions.clear();
+        input_index.clear();
+        rewritten.clear();
+        negative_gep_addr = 1024;
+    }
+
+    // Exit on a failure, unless errors are returned to the caller. The module must be discarded then
+    void fail(const std::string &msg) {
+        if (!error_out) {
+            outs() << msg << "\n";
+            outs().flush();
+            exit(1);
+        }
+        if (error_out->empty()) {
+            *error_out = msg;
+        }
+    }
+
+    [[nodiscard]] bool hasFailed() const {
+        return error_out && !error_out->empty();
+    }
+
+    // The instruction was replaced, it may be dead now
+    void markRewritten(Value *v) {
+        if (isa<Instruction>(v)) {
+            rewritten.emplace_back(v);
+        }
+    }
+
+    // Check if every user of v is one of the allowed globals or an instruction of an allowed function
+    // Constant expressions and aggregates are looked through
+    static bool isOnlyUsedBy(Value *v, const std::unordered_set<const Value*> &allowed) {
+        for (auto *user : v->users()) {
+            if (auto *inst = dyn_cast<Instruction>(user)) {
+                if (!allowed.contains(inst->getFunction())) {
+                    return false;
+                }
+            } else if (isa<GlobalValue>(user)) {
+                if (!allowed.contains(user)) {
+                    return false;
+                }
+            } else if (!isa<Constant>(user) || !isOnlyUsedBy(user, allowed)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Singleton and its stubs form a closed cycle: nothing outside reads or writes them
+    bool isUnreferencedSingleton(StructType *T, GlobalVariable *singleton, std::vector<Function*> &stubs) {
+        std::unordered_set<const Value*> allowed{singleton};
+        for (size_t i = 0; i < T->getNumElements(); i++) {
+            if (auto *stub = getPartitionStub(T, i, 0)) {
+                stubs.push_back(stub);
+                allowed.insert(stub);
+            }
+        }
+        return isOnlyUsedBy(singleton, allowed) && std::ranges::all_of(stubs, [&allowed](Function *stub) {
+            return isOnlyUsedBy(stub, allowed);
+        });
+    }
+
+    // Erase rewritten instructions and their dead operand chains, then singletons and stubs, that nothing uses.
+    // Singletons may point to each other, so they are dropped until nothing changes.
+    // Hub singletons are always kept: they are linked by partition copies.
+    void removeDeadResidue(Module &M) {
+        size_t erased_instructions = 0;
+        RecursivelyDeleteTriviallyDeadInstructionsPermissive(rewritten, nullptr, nullptr, [&](Value *) {
+            erased_instructions++;
+        });
+        rewritten.clear();
+
+        size_t erased_singletons = 0, erased_stubs = 0;
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (auto *T : M.getIdentifiedStructTypes()) {
+                auto it = singletons.find(T);
+                if (it == singletons.end() || hubs.isHub(T)) {
+                    continue;
+                }
+                auto *singleton = it->second;
+                std::vector<Function*> stubs;
+                if (!isUnreferencedSingleton(T, singleton, stubs)) {
+                    continue;
+                }
+                for (auto *stub : stubs) {
+                    stub->deleteBody();
+                }
+                singleton->setInitializer(nullptr);
+                for (auto *stub : stubs) {
+                    stub->removeDeadConstantUsers();
+                    stub_fields.erase(stub);
+                    new_functions.erase(stub);
+                    stub->eraseFromParent();
+                }
+                for (size_t i = 0; i < T->getNumElements(); i++) {
+                    function_stubs.erase({T, i});
+                }
+                singleton->removeDeadConstantUsers();
+                new_globals.erase(singleton);
+                singleton->eraseFromParent();
+                singletons.erase(it);
+                erased_singletons++;
+                erased_stubs += stubs.size();
+                changed = true;
+            }
+        }
+        outs() << "Cleanup: erased " << erased_instructions << " instructions, " << erased_singletons;
+        outs() << " singletons and " << erased_stubs << " stubs\n";
+        outs().flush();
+    }
+
+    // Candidate for the work budget
+    struct budget_candidate {
+        uint64_t value;
+        uint64_t insts;
+        uint64_t calls;
+        uint64_t copy_bytes;
+        std::string description;
+        std::function<void()> drop;
+    };
+
+    // Indirect call sites and stored functions of every function pointer field
+    std::map<std::pair<StructType*, size_t>, uint64_t, struct_field_less> collectFieldValues(Module &M) {
+        std::map<std::pair<StructType*, size_t>, uint64_t, struct_field_less> values;
+        constant_walker initializers([&values](Constant *c) {
+            auto *init_struct = dyn_cast<ConstantStruct>(c);
+            if (init_struct && !init_struct->getType()->isLiteral()) {
+                for (size_t i = 0; i < init_struct->getNumOperands(); i++) {
+                    if (isa<Function>(init_struct->getOperand(i)->stripPointerCasts())) {
+                        values[{init_struct->getType(), i}]++;
+                    }
+                }
+            }
+            return c;
+        });
+        for (auto &glob : M.globals()) {
+            if (glob.hasInitializer()) {
+                initializers.walk(glob.getInitializer());
+            }
+        }
+        for (auto &f : M) {
+            for (auto &bb : f) {
+                for (auto &inst : bb) {
+                    if (auto *call = dyn_cast<CallBase>(&inst)) {
+                        if (auto field = getCalledField(call)) {
+                            values[*field]++;
+                        }
+                    } else if (auto *store = dyn_cast<StoreInst>(&inst)) {
+                        auto field = getAccessedField(store->getPointerOperand());
+                        if (field && isa<Function>(store->getValueOperand()->stripPointerCasts())) {
+                            values[*field]++;
+                        }
+                    }
+                }
+            }
+        }
+        return values;
+    }
+
+    // Rank stubs, dummy calls and global copies by the number of indirect call sites and stored functions
+    // they serve and keep the most valuable ones, that fit into the budget. Phases skip dropped candidates.
+    void planWorkBudget(Module &M) {
+        work_budget budget{BudgetInsts.getValue(), BudgetCalls.getValue(), BudgetCopyBytes.getValue()};
+        if (!budget.isLimited()) {
+            return;
+        }
+        auto &DL = M.getDataLayout();
+        auto field_values = collectFieldValues(M);
+        auto fieldValue = [&field_values](StructType *T, size_t idx) -> uint64_t {
+            auto it = field_values.find({T, idx});
+            return it == field_values.end() ? 0 : it->second;
+        };
+        auto typeValue = [&](Type *t) -> uint64_t {
+            auto *T = getStructType(t);
+            if (!T || !type_tracker.isInterestingType(T)) {
+                return 0;
+            }
+            uint64_t value = 1;
+            for (size_t i = 0; i < T->getNumElements(); i++) {
+                value += fieldValue(T, i);
+            }
+            return value;
+        };
+
+        std::vector<budget_candidate> candidates;
+        for (auto *T : type_tracker.getInterestingTypes()) {
+            size_t partitions = hubs.isHub(T) ? hubs.getPartitionCount() : 1;
+            for (size_t i = 0; i < T->getNumElements(); i++) {
+                if (!isFunctionPointer(T->getElementType(i))) {
+                    continue;
+                }
+                // Load, call and return, devirtualized stubs compare, branch, call and return per target
+                uint64_t insts = 3;
+                if (DevirtualizeStubs.getValue()) {
+                    if (auto targets = stored_functions.getClosedTargets(T, i)) {
+                        insts = 2 + 4 * targets->size();
+                    }
+                }
+                candidates.push_back({
+                    1 + fieldValue(T, i), insts * partitions, 0, 0, "stub " + funcStubName(T->getName().str(), i),
+                    [this, T, i]() { dropped_stubs.insert({T, i}); }
+                });
+            }
+        }
+        if (CallFunctions.getValue()) {
+            for (auto *f : findDummyCallTargets(M)) {
+                uint64_t value = 1 + typeValue(f->getReturnType());
+                for (auto *arg : f->getFunctionType()->params()) {
+                    value += typeValue(arg);
+                }
+                uint64_t bytes = type_tracker.isPtrToInterestingType(f->getReturnType()) ?
+                        DL.getTypeAllocSize(f->getReturnType()->getNonOpaquePointerElementType()) : 0;
+                candidates.push_back({
+                    value, bytes ? 2u : 1u, 1, bytes, "dummy call " + f->getName().str(),
+                    [this, f]() { dropped_work.insert(f); }
+                });
+            }
+        }
+        if (CopyFromGlobals.getValue()) {
+            for (auto &glob : M.getGlobalList()) {
+                auto *type = getCopiedGlobalType(glob);
+                if (!type) {
+                    continue;
+                }
+                auto *arr_ty = dyn_cast<ArrayType>(glob.getValueType());
+                uint64_t copies = arr_ty ? arr_ty->getNumElements() : 1;
+                // One memcpy per element, GEPs of elements are folded into constant expressions
+                candidates.push_back({
+                    typeValue(type), copies, 0, copies * DL.getTypeAllocSize(type),
+                    "global copy " + glob.getName().str(),
+                    [this, &glob]() { dropped_work.insert(&glob); }
+                });
+            }
+        }
+
+        std::stable_sort(candidates.begin(), candidates.end(), [](auto &a, auto &b) {
+            return a.value > b.value;
+        });
+        size_t dropped = 0;
+        for (auto &candidate : candidates) {
+            if (!budget.take(candidate.insts, candidate.calls, candidate.copy_bytes)) {
+                candidate.drop();
+                outs() << "[budget] dropped " << candidate.description << "\n";
+                dropped++;
+            }
+        }
+        outs() << "[budget] kept " << candidates.size() - dropped << " of " << candidates.size() << " candidates: ";
+        outs() << budget.used_insts << " instructions, " << budget.used_calls << " calls, ";
+        outs() << budget.used_copy_bytes << " copy bytes\n";
+        outs().flush();
+    }
+
+    // Count everything the enabled phases would create or replace, using the same candidates
+    void estimateInstrumentation(Module &M) {
+        auto &DL = M.getDataLayout();
+        auto typeSize = [&DL](Type *t) -> uint64_t {
+            return DL.getTypeAllocSize(t);
+        };
+        auto addInterestingType = [this](phase_estimate &estimate, Type *t, size_t n, uint64_t bytes = 0) {
+            auto *type = getStructType(t);
+            if (type && type_tracker.isInterestingType(type)) {
+                estimate.addType(type, n, bytes);
+            }
+        };
+        auto partitionsOf = [this](StructType *T) -> size_t {
+            return hubs.isHub(T) ? hubs.getPartitionCount() : 1;
+        };
+
+        phase_estimate singleton_estimate, stub_estimate, devirt_estimate, copy_estimate;
+        for (auto *T : M.getIdentifiedStructTypes()) {
+            singleton_estimate.add(partitionsOf(T));
+            addInterestingType(singleton_estimate, T, partitionsOf(T));
+        }
+        for (auto *T : type_tracker.getInterestingTypes()) {
+            size_t partitions = partitionsOf(T);
+            for (size_t i = 0; i < T->getNumElements(); i++) {
+                auto *field = T->getElementType(i);
+                if (isFunctionPointer(field)) {
+                    if (dropped_stubs.contains({T, i})) {
+                        continue;
+                    }
+                    stub_estimate.add(partitions);
+                    stub_estimate.addType(T, partitions);
+                    // Such stubs compare the loaded pointer with known targets and call them directly
+                    if (DevirtualizeStubs.getValue() && stored_functions.getClosedTargets(T, i)) {
+                        devirt_estimate.add(partitions);
+                        devirt_estimate.addType(T, partitions);
+                    }
+                } else if (type_tracker.isInterestingType(field)) {
+                    copy_estimate.add(2 * partitions, 2 * partitions * typeSize(field));
+                    copy_estimate.addType(T, 2 * partitions, 2 * partitions * typeSize(field));
+                }
+            }
+            if (partitions > 1) {
+                copy_estimate.add(partitions - 1, (partitions - 1) * typeSize(T));
+                copy_estimate.addType(T, partitions - 1, (partitions - 1) * typeSize(T));
+            }
+        }
+        singleton_estimate.print(outs(), "singletons");
+        stub_estimate.print(outs(), "stubs");
+        if (DevirtualizeStubs.getValue()) {
+            devirt_estimate.print(outs(), "devirtualized stubs");
+        }
+        copy_estimate.print(outs(), "singleton copies");
+
+        if (MapByteGEPs.getValue()) {
+            phase_estimate byte_gep_estimate;
+            for (auto &byte_gep : findByteGEPs(M)) {
+                byte_gep_estimate.add(1);
+                byte_gep_estimate.addType(byte_gep.base_type, 1);
+            }
+            byte_gep_estimate.print(outs(), "byte offset GEPs");
+        }
+
+        phase_estimate gep_estimate, cast_estimate, call_site_estimate;
+        for (auto &f : M) {
+            if (!scope.contains(&f)) {
+                continue;
+            }
+            for (auto &bb : f) {
+                for (auto &inst : bb) {
+                    if (auto *gep = dyn_cast<GetElementPtrInst>(&inst); gep && isNegativeGEP(gep)) {
+                        gep_estimate.add(1);
+                        addInterestingType(gep_estimate, gep->getSourceElementType(), 1);
+                    } else if (auto *cast = dyn_cast<BitCastInst>(&inst)) {
+                        auto [kind, type] = classifyCast(cast);
+                        size_t replaced = 0;
+                        if (kind == cast_kind::pointer) {
+                            replaced = 1;
+                        } else if (kind == cast_kind::loaded_pointer) {
+                            replaced = std::ranges::count_if(cast->users(), [](User *u) { return isa<LoadInst>(u); });
+                        }
+                        if (replaced) {
+                            cast_estimate.add(replaced);
+                            cast_estimate.addType(type, replaced);
+                        }
+                    } else if (auto *call = dyn_cast<CallBase>(&inst)) {
+                        // Calls of dropped stubs are kept
+                        auto field = getStubCallField(call);
+                        if (field && !dropped_stubs.contains(*field)) {
+                            call_site_estimate.add(1);
+                            call_site_estimate.addType(field->first, 1);
+                        }
+                    }
+                }
+            }
+        }
+        if (RemoveNegativeGEPs.getValue()) {
+            gep_estimate.print(outs(), "negative GEPs");
+        }
+        if (ReplaceBitcasts.getValue()) {
+            cast_estimate.print(outs(), "bitcasts");
+        }
+        if (CallStubs.getValue()) {
+            call_site_estimate.print(outs(), "stub calls");
+        }
+
+        if (CopyFromGlobals.getValue()) {
+            phase_estimate global_estimate;
+            for (auto &glob : M.getGlobalList()) {
+                if (auto *type = getCopiedGlobalType(glob); type && !dropped_work.contains(&glob)) {
+                    auto *arr_ty = dyn_cast<ArrayType>(glob.getValueType());
+                    size_t copies = arr_ty ? arr_ty->getNumElements() : 1;
+                    global_estimate.add(copies, copies * typeSize(type));
+                    global_estimate.addType(type, copies, copies * typeSize(type));
+                }
+            }
+            global_estimate.print(outs(), "global copies");
+        }
+
+        if (CallFunctions.getValue()) {
+            phase_estimate call_estimate;
+            for (auto *f : findDummyCallTargets(M)) {
+                if (dropped_work.contains(f)) {
+                    continue;
+                }
+                auto *ret_type = f->getReturnType();
+                uint64_t bytes = type_tracker.isPtrToInterestingType(ret_type) ?
+                        typeSize(ret_type->getNonOpaquePointerElementType()) : 0;
+                call_estimate.add(1, bytes);
+                addInterestingType(call_estimate, ret_type, 1, bytes);
+                for (auto *arg : f->getFunctionType()->params()) {
+                    addInterestingType(call_estimate, arg, 1);
+                }
+            }
+            call_estimate.print(outs(), "dummy calls");
+        }
+
+        if (ImplementExternal.getValue()) {
+            phase_estimate declaration_estimate;
+            // Objects, that are kept and filled, are synced by one helper per type(and hub partition)
+            std::set<std::pair<StructType*, size_t>, struct_field_less> synced;
+            for (auto *f : findDeclarationsToImplement(M)) {
+                // Callers in other hub partitions get their own body
+                std::vector<size_t> partitions = {0};
+                for (auto &[partition, calls] : findPartitionCalls(f)) {
+                    partitions.push_back(partition);
+                }
+                declaration_estimate.add(partitions.size());
+                // Argument index and number of copies
+                std::vector<std::pair<unsigned, size_t>> copies;
+                if (auto *effects = extern_models.find(f->getName())) {
+                    for (auto &effect : *effects) {
+                        if (effect.kind == extern_effect::keep || effect.kind == extern_effect::fill) {
+                            copies.emplace_back(effect.arg, 1);
+                        } else if (effect.kind == extern_effect::sync) {
+                            copies.emplace_back(effect.arg, 2);
+                        }
+                    }
+                } else {
+                    for (unsigned i = 0; i < f->arg_size(); i++) {
+                        copies.emplace_back(i, 2);
+                    }
+                }
+                for (auto [arg, n] : copies) {
+                    if (arg >= f->arg_size() || !type_tracker.isPtrToInterestingType(f->getArg(arg)->getType())) {
+                        continue;
+                    }
+                    auto *type = dereferenceStructPtr(f->getArg(arg)->getType());
+                    if (n == 2) {
+                        for (auto partition : partitions) {
+                            synced.insert({type, hubs.isHub(type) ? partition : 0});
+                        }
+                        declaration_estimate.addType(type, partitions.size());
+                    } else {
+                        declaration_estimate.add(0, partitions.size() * typeSize(type));
+                        declaration_estimate.addType(type, partitions.size(), partitions.size() * typeSize(type));
+                    }
+                }
+            }
+            for (auto [type, partition] : synced) {
+                declaration_estimate.add(0, 2 * typeSize(type));
+                declaration_estimate.addType(type, 0, 2 * typeSize(type));
+            }
+            declaration_estimate.print(outs(), "declaration bodies");
+        }
+
+        if (SummarizeBodies.getValue()) {
+            phase_estimate summary_estimate;
+            summary_estimate.add(findSummarizableBodies(M).size());
+            summary_estimate.print(outs(), "summaries");
+        }
+        outs().flush();
+    }
+
+    // Print changes since the last snapshot and update it
+    void reportPhaseMetrics(Module &M, const std::string &phase, metrics_collector &last) {
+        if (!ReportMetrics.getValue()) {
+            return;
+        }
+        metrics_collector current(&type_tracker);
+        current.collect(M);
+        current.printDelta(outs(), phase, last);
+        outs().flush();
+        last = std::move(current);
+    }
+
+    GlobalVariable* getPartitionSingleton(StructType *T, size_t partition) {
+        if (partition != 0 && hubs.isHub(T)) {
+            return hub_singletons[T][partition];
+        }
+        return singletons[T];
+    }
+
+    // Singleton, that holds objects used by the site(function or global)
+    // Shared code without a site uses the main singleton
+    GlobalVariable* getSingleton(StructType *T, const GlobalValue *site) {
+        return getPartitionSingleton(T, site ? hubs.getPartition(site) : 0);
+    }
+
+    // Stub of the field in the partition, nullptr if it was not created
+    Function* getPartitionStub(StructType *T, size_t field_idx, size_t partition) {
+        if (hubs.isHub(T)) {
+            auto it = hub_stubs.find({T, field_idx});
+            return it == hub_stubs.end() ? nullptr : it->second[partition];
+        }
+        auto it = function_stubs.find({T, field_idx});
+        return it == function_stubs.end() ? nullptr : it->second;
+    }
+
+    // Stub of the field, that is used by the site
+    Function* getStub(StructType *T, size_t field_idx, const GlobalValue *site) {
+        return getPartitionStub(T, field_idx, site ? hubs.getPartition(site) : 0);
+    }
+
     // Check if any function argument or return value are interesting
     bool functionContainsInterestingStruct(FunctionType *f_type) {
         if (type_tracker.isInterestingTypeOrPtr(f_type->getReturnType())) {
@@ -139,13 +991,18 @@ private:
     // Create an argument default value
     // Flow-sensitivity is not expected from the following analysis, so it's fine to put any fitting value
     // But here we try to use singletons as much as we can
-    Value* constructTypeValue(Type *t, IRBuilder<> &builder) {
+    Value* constructTypeValue(Type *t, IRBuilder<> &builder, const GlobalValue *site = nullptr) {
+        return constructPartitionValue(t, builder, site ? hubs.getPartition(site) : 0);
+    }
+
+    // Default value, that uses singletons of the partition
+    Value* constructPartitionValue(Type *t, IRBuilder<> &builder, size_t partition) {
         if (t->isIntegerTy()) {
             return builder.getIntN(t->getIntegerBitWidth(), 0);
         }
         if (t->isStructTy()) {
             // We added all singletons, there should be one for this struct
-            auto obj = singletons[dyn_cast<StructType>(t)];
+            auto obj = getPartitionSingleton(dyn_cast<StructType>(t), partition);
             if (!obj) {
                 // Special case for timespec64 return type
                 return Constant::getNullValue(dyn_cast<StructType>(t));
@@ -155,77 +1012,188 @@ private:
         if (t->isPointerTy()) {
             auto underlying_t = t->getNonOpaquePointerElementType();
             if (type_tracker.isInterestingType(underlying_t)) {
-                return singletons[dyn_cast<StructType>(underlying_t)];
+                return getPartitionSingleton(dyn_cast<StructType>(underlying_t), partition);
             } else {
                 return ConstantPointerNull::get(dyn_cast<PointerType>(t));
             }
         }
-        outs() << "Unknown type!\n";
-        outs().flush();
-        t->dump();
-        outs().flush();
-        exit(1);
+        if (t->isFloatingPointTy() || t->isVectorTy()) {
+            // Nothing is tracked in such values
+            return Constant::getNullValue(t);
+        }
+        std::string type_str;
+        raw_string_ostream(type_str) << *t;
+        fail("Unknown type " + type_str);
+        return UndefValue::get(t);
+    }
+
+    // Find all functions, that never load, store or pass interesting objects or function pointers
+    std::vector<Function*> findSummarizableBodies(Module &M) {
+        body_summarizer summarizer(type_tracker);
+        for (auto &f : M) {
+            if (new_functions.contains(&f) || f.isDeclaration() || !f.hasName()) {
+                continue;
+            }
+            summarizer.addFunction(f.getName().str(), collectBodyFacts(f));
+        }
+        auto summarizable = summarizer.findSummarizable();
+        // Iterate over the module to keep the output stable
+        std::vector<Function*> bodies;
+        for (auto &f : M) {
+            if (f.hasName() && summarizable.contains(f.getName().str()) && scope.contains(&f)) {
+                bodies.push_back(&f);
+            }
+        }
+        return bodies;
+    }
+
+    // Replace bodies of irrelevant functions with trivial summaries
+    size_t summarizeIrrelevantBodies(Module &M) {
+        auto bodies = findSummarizableBodies(M);
+        for (auto *f : bodies) {
+            body_summarizer::summarizeFunction(f);
+        }
+        return bodies.size();
+    }
+
+    // SVF uses LLVM-16, which doesn't support constant SDiv and UDiv instructions
+    // Replace them with zeroes, they are unlikely to make any difference
+    // Divisions may be nested in other constant expressions or in global initializers
+    void removeDivOperator(Module &M) {
+        constant_walker div_remover([](Constant *c) -> Constant* {
+            if (auto *ce = dyn_cast<ConstantExpr>(c)) {
+                if (ce->getOpcode() == Instruction::UDiv || ce->getOpcode() == Instruction::SDiv) {
+                    return ConstantInt::get(ce->getType(), 0);
+                }
+            }
+            return c;
+        });
+        for (auto &glob : M.getGlobalList()) {
+            if (!glob.hasInitializer()) {
+                continue;
+            }
+            auto *initializer = glob.getInitializer();
+            auto *new_initializer = div_remover.walk(initializer);
+            if (new_initializer != initializer) {
+                glob.setInitializer(new_initializer);
+            }
+        }
+        for (auto &f : M) {
+            if (new_functions.contains(&f)) {
+                continue;
+            }
+            for (auto &bb : f) {
+                for (auto &inst : bb) {
+                    for (size_t i = 0; i < inst.getNumOperands(); i++) {
+                        auto *op = dyn_cast<Constant>(inst.getOperand(i));
+                        if (!op) {
+                            continue;
+                        }
+                        auto *new_op = div_remover.walk(op);
+                        if (new_op != op) {
+                            inst.setOperand(i, new_op);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // Function pointer field of an interesting type, that is loaded and called
+    std::optional<std::pair<StructType*, size_t>> getStubCallField(CallBase *call) {
+        auto field = getCalledField(call);
+        if (!field || !type_tracker.isInterestingType(field->first) ||
+                !isFunctionPointer(field->first->getElementType(field->second))) {
+            return std::nullopt;
+        }
+        return field;
     }
 
-    // SVF uses LLVM-16, which doesn't support constant SDiv and UDiv instructions
-    // Replace them with zeroes, they are unlikely to make any difference
-    void removeDivOperator(Module &M) {
+    // Replace calls of function pointers loaded from interesting fields with stub calls,
+    // so every field has only one indirect call: the one in its stub
+    size_t replaceIndirectCalls(Module &M) {
+        size_t replaced = 0;
         for (auto &f : M) {
-            if (new_functions.contains(&f)) {
+            if (new_functions.contains(&f) || !scope.contains(&f)) {
                 continue;
             }
             for (auto &bb : f) {
                 for (auto &inst : bb) {
-                    for (size_t i = 0; i < inst.getNumOperands(); i++) {
-                        Value *op = inst.getOperand(i);
-                        if (auto *ce = dyn_cast<ConstantExpr>(op)) {
-                            if (ce->getOpcode() == Instruction::UDiv || ce->getOpcode() == Instruction::SDiv) {
-                                Constant *Zero = ConstantInt::get(ce->getType(), 0);
-                                inst.setOperand(i, Zero);
-                            }
-                        }
+                    auto *call = dyn_cast<CallBase>(&inst);
+                    auto field = call ? getStubCallField(call) : std::nullopt;
+                    if (!field) {
+                        continue;
                     }
+                    auto *stub = getStub(field->first, field->second, &f);
+                    if (!stub) {
+                        continue;
+                    }
+                    markRewritten(call->getCalledOperand());
+                    if (stub->getFunctionType() == call->getFunctionType()) {
+                        call->setCalledFunction(stub);
+                    } else {
+                        call->setCalledOperand(ConstantExpr::getBitCast(stub, call->getCalledOperand()->getType()));
+                    }
+                    replaced++;
                 }
             }
         }
+        return replaced;
+    }
+
+    enum class cast_kind {
+        none,
+        // SrcT* -> InterestingT*, the cast is replaced with the singleton
+        pointer,
+        // T* -> InterestingT**, loads through the cast are replaced with the singleton
+        loaded_pointer,
+    };
+
+    // Decide how the bitcast is replaced and which singleton is used
+    std::pair<cast_kind, StructType*> classifyCast(BitCastInst *cast) {
+        auto *dst_type = cast->getDestTy();
+        auto *deref_dst_type = dyn_cast<PointerType>(dst_type);
+        if (type_tracker.isPtrToInterestingType(dst_type)) {
+            return {cast_kind::pointer, dereferenceStructPtr(dst_type)};
+        }
+        if (deref_dst_type && type_tracker.isPtrToInterestingType(deref_dst_type->getNonOpaquePointerElementType())) {
+            return {cast_kind::loaded_pointer, dereferenceStructPtr(deref_dst_type->getNonOpaquePointerElementType())};
+        }
+        return {cast_kind::none, nullptr};
     }
 
     // Find all bitcasts, that can lead to ptr leak and replace them
     // Run this AFTER creating singletons
     void replaceRestrictedCasts(Module &M) {
         for (auto &f : M) {
-            if (new_functions.contains(&f)) {
+            if (new_functions.contains(&f) || !scope.contains(&f)) {
                 continue;
             }
             std::vector<Instruction*> remove_list;
             for (auto &bb : f) {
                 for (auto &inst : bb) {
-                    if (auto *cast = dyn_cast<BitCastInst>(&inst)) {
-                        auto *dst_type = cast->getDestTy();
-                        auto *deref_dst_type = dyn_cast<PointerType>(dst_type);
-
-                        // SrcT* -> InterestingT*
-                        if (type_tracker.isPtrToInterestingType(dst_type)) {
-                            inst.replaceUsesWithIf(
-                                    singletons[dereferenceStructPtr(dst_type)],
-                                    [&](Use &u) {
-                                // FIXME: What's wrong with GEPs?
-                                return true;
-                                //return dyn_cast<GetElementPtrInst>(u.getUser()) == nullptr;
-                            });
-                        } else if (deref_dst_type &&
-                                type_tracker.isPtrToInterestingType(deref_dst_type->getNonOpaquePointerElementType())) {
-                            // This is a T* -> X** cast
-                            // X** will be later used for a load, so replace all loads with singleton
-                            for (auto *user : inst.users()) {
-                                if (auto *load = dyn_cast<LoadInst>(user)) {
-                                    load->replaceAllUsesWith(
-                                        singletons[
-                                            dereferenceStructPtr(deref_dst_type->getNonOpaquePointerElementType())
-                                        ]
-                                    );
-                                    remove_list.push_back(load);
-                                }
+                    auto *cast = dyn_cast<BitCastInst>(&inst);
+                    if (!cast) {
+                        continue;
+                    }
+                    auto [kind, type] = classifyCast(cast);
+                    if (kind != cast_kind::none) {
+                        markRewritten(cast);
+                    }
+                    if (kind == cast_kind::pointer) {
+                        inst.replaceUsesWithIf(
+                                getSingleton(type, &f),
+                                [&](Use &u) {
+                            // FIXME: What's wrong with GEPs?
+                            return true;
+                            //return dyn_cast<GetElementPtrInst>(u.getUser()) == nullptr;
+                        });
+                    } else if (kind == cast_kind::loaded_pointer) {
+                        // X** will be later used for a load, so replace all loads with singleton
+                        for (auto *user : inst.users()) {
+                            if (auto *load = dyn_cast<LoadInst>(user)) {
+                                load->replaceAllUsesWith(getSingleton(type, &f));
+                                remove_list.push_back(load);
                             }
                         }
                     }
@@ -237,6 +1205,132 @@ private:
         }
     }
 
+    // i8 GEP with a constant byte offset from a struct pointer and the field it points to
+    struct byte_gep {
+        GetElementPtrInst *gep;
+        // pointer to the struct, bitcasts to i8* are stripped
+        Value *base;
+        StructType *base_type;
+        // indices of a field GEP from the base
+        std::vector<Value*> indices;
+    };
+
+    // Walk the byte offset down through nested structs and arrays with their layouts. Stop at the first field, that
+    // starts exactly at the offset and has the wanted type, or at the outermost such field if none has it.
+    static std::optional<std::vector<Value*>> mapByteOffset(
+            const DataLayout &DL, StructType *T, uint64_t offset, Type *wanted
+    ) {
+        auto *i32_ty = Type::getInt32Ty(T->getContext());
+        auto *i64_ty = Type::getInt64Ty(T->getContext());
+        std::vector<Value*> indices{ConstantInt::get(i64_ty, 0)};
+        std::optional<std::vector<Value*>> outermost;
+        Type *cur = T;
+        while (true) {
+            if (auto *st = dyn_cast<StructType>(cur); st && !st->isOpaque()) {
+                auto *layout = DL.getStructLayout(st);
+                if (offset >= layout->getSizeInBytes()) {
+                    break;
+                }
+                unsigned idx = layout->getElementContainingOffset(offset);
+                offset -= layout->getElementOffset(idx);
+                indices.push_back(ConstantInt::get(i32_ty, idx));
+                cur = st->getElementType(idx);
+            } else if (auto *arr = dyn_cast<ArrayType>(cur)) {
+                uint64_t size = DL.getTypeAllocSize(arr->getElementType());
+                if (size == 0 || offset >= size * arr->getNumElements()) {
+                    break;
+                }
+                indices.push_back(ConstantInt::get(i64_ty, offset / size));
+                offset %= size;
+                cur = arr->getElementType();
+            } else {
+                break;
+            }
+            if (offset != 0) {
+                continue;
+            }
+            if (cur == wanted) {
+                return indices;
+            }
+            if (!outermost) {
+                outermost = indices;
+            }
+        }
+        return outermost;
+    }
+
+    // Find i8 GEPs with constant non-negative offsets from pointers to interesting structs.
+    // Type of a pointer cast of the GEP picks the field, if several nested fields start at the offset.
+    std::vector<byte_gep> findByteGEPs(Module &M) {
+        auto &DL = M.getDataLayout();
+        std::vector<byte_gep> found;
+        for (auto &f : M) {
+            if (new_functions.contains(&f) || !scope.contains(&f)) {
+                continue;
+            }
+            for (auto &bb : f) {
+                for (auto &inst : bb) {
+                    auto *gep = dyn_cast<GetElementPtrInst>(&inst);
+                    if (!gep || !gep->getSourceElementType()->isIntegerTy(8) || gep->getNumIndices() != 1) {
+                        continue;
+                    }
+                    auto *offset = dyn_cast<ConstantInt>(gep->getOperand(1));
+                    if (!offset || offset->isNegative()) {
+                        continue;
+                    }
+                    auto *base = gep->getPointerOperand();
+                    while (auto *cast = dyn_cast<BitCastOperator>(base)) {
+                        base = cast->getOperand(0);
+                    }
+                    auto *base_type = dereferenceStructPtr(base->getType());
+                    if (!base_type || !type_tracker.isInterestingType(base_type)) {
+                        continue;
+                    }
+                    Type *wanted = nullptr;
+                    for (auto *user : gep->users()) {
+                        if (auto *cast = dyn_cast<BitCastInst>(user); cast && cast->getDestTy()->isPointerTy()) {
+                            wanted = cast->getDestTy()->getNonOpaquePointerElementType();
+                            break;
+                        }
+                    }
+                    if (auto field = mapByteOffset(DL, base_type, offset->getZExtValue(), wanted)) {
+                        found.push_back({gep, base, base_type, std::move(*field)});
+                    }
+                }
+            }
+        }
+        return found;
+    }
+
+    // offsetof arithmetic and container_of bodies reach fields through i8 pointers, so pointer analysis
+    // sees only the whole object. Field GEPs keep these flows field-sensitive.
+    // Casts of the byte GEP to the field pointer type are replaced with the field GEP itself.
+    size_t mapAllByteGEPs(Module &M) {
+        auto byte_geps = findByteGEPs(M);
+        for (auto &[gep, base, base_type, indices] : byte_geps) {
+            IRBuilder<> builder(gep);
+            auto *field_ptr = gep->isInBounds() ?
+                    builder.CreateInBoundsGEP(base_type, base, indices) : builder.CreateGEP(base_type, base, indices);
+            std::vector<BitCastInst*> field_casts;
+            for (auto *user : gep->users()) {
+                if (auto *cast = dyn_cast<BitCastInst>(user); cast && cast->getDestTy() == field_ptr->getType()) {
+                    field_casts.push_back(cast);
+                }
+            }
+            for (auto *cast : field_casts) {
+                cast->replaceAllUsesWith(field_ptr);
+                cast->eraseFromParent();
+            }
+            field_ptr->takeName(gep);
+            markRewritten(gep->getPointerOperand());
+            if (!gep->use_empty()) {
+                gep->replaceAllUsesWith(builder.CreateBitCast(field_ptr, gep->getType()));
+            }
+            gep->eraseFromParent();
+        }
+        return byte_geps.size();
+    }
+
     // Negative GEPs are generally used by container_of-like macros, but they can easily trick pointer
     // analysis tools, especially when this utility reuses one object for several calls.
     // Replace every negative GEP with "random" integral address to prevent any interference.
@@ -247,7 +1341,7 @@ private:
         IRBuilder<> builder(ctx);
         size_t total_removed = 0;
         for (auto &f : M) {
-            if (new_functions.contains(&f)) {
+            if (new_functions.contains(&f) || !scope.contains(&f)) {
                 continue;
             }
             total_removed += replaceNegativeGEPs(&f, ctx, builder);
@@ -255,27 +1349,29 @@ private:
         return total_removed;
     }
 
+    static bool isNegativeGEP(GetElementPtrInst *gep) {
+        return std::any_of(gep->indices().begin(), gep->indices().end(), [](Value *v) {
+            if (auto *const_idx = dyn_cast<ConstantInt>(v)) {
+                return const_idx->getValue().isNegative();
+            }
+            return false;
+        });
+    }
+
     size_t replaceNegativeGEPs(Function *f, LLVMContext &ctx, IRBuilder<> &builder) {
         size_t replaced = 0;
         // Avoid any pointer interference by using different addresses
-        static int64_t addr = 1024;
         for (auto &bb : *f) {
             for (auto &inst : bb) {
-                if (auto *gep = dyn_cast<GetElementPtrInst>(&inst)) {
-                    bool negative_gep = std::any_of(gep->indices().begin(), gep->indices().end(), [](Value *v) {
-                        if (auto *const_idx = dyn_cast<ConstantInt>(v)) {
-                            return const_idx->getValue().isNegative();
-                        }
-                        return false;
-                    });
-                    if (negative_gep) {
-                        Value *addr_val = ConstantInt::get(Type::getInt64Ty(ctx), addr);
-                        gep->replaceAllUsesWith(
-                            builder.CreateIntToPtr(addr_val, gep->getType())
-                        );
-                        replaced++;
-                        addr += 1024;
-                    }
+                auto *gep = dyn_cast<GetElementPtrInst>(&inst);
+                if (gep && isNegativeGEP(gep)) {
+                    Value *addr_val = ConstantInt::get(Type::getInt64Ty(ctx), negative_gep_addr);
+                    gep->replaceAllUsesWith(
+                        builder.CreateIntToPtr(addr_val, gep->getType())
+                    );
+                    markRewritten(gep);
+                    replaced++;
+                    negative_gep_addr += 1024;
                 }
             }
         }
@@ -291,7 +1387,7 @@ private:
 
         std::vector<Value*> call_args;
         for (auto arg : f->getFunctionType()->params()) {
-            call_args.push_back(constructTypeValue(arg, builder));
+            call_args.push_back(constructTypeValue(arg, builder, f));
         }
         auto call_ret = builder.CreateCall(f, call_args);
 
@@ -307,7 +1403,7 @@ private:
         if (type_tracker.isPtrToInterestingType(f->getReturnType())) {
             auto* ret_struct = dyn_cast<StructType>(f->getReturnType()->getNonOpaquePointerElementType());
             builder.CreateMemCpy(
-                singletons[ret_struct],
+                getSingleton(ret_struct, f),
                 MaybeAlign(),
                 call_ret,
                 MaybeAlign(),
@@ -316,10 +1412,53 @@ private:
         }
     }
 
-    // Make calls to all functions, that consume or produce interesting structures
-    // to track written and read values. Currently internal functions are skipped as they
-    // cannot be called from outside.
-    void propagateSingletons(Module &M) {
+    bool isRegisterFunction(Function *f) {
+        auto name = f->getName().str();
+        return DEFAULT_REGISTER_FUNCTIONS.contains(name) || llvm::is_contained(RegisterFunctions, name);
+    }
+
+    // Check if the value(function or a constant containing it) is saved into a global or memory,
+    // or passed to a register function
+    bool isAddressExported(Value *v, std::unordered_set<Value*> &visited) {
+        if (!visited.insert(v).second) {
+            return false;
+        }
+        for (auto &use : v->uses()) {
+            auto *user = use.getUser();
+            if (isa<GlobalVariable>(user)) {
+                // Part of the initializer
+                return true;
+            }
+            if (auto *store = dyn_cast<StoreInst>(user)) {
+                if (store->getValueOperand() == v) {
+                    return true;
+                }
+            } else if (auto *call = dyn_cast<CallBase>(user)) {
+                auto *callee = call->getCalledFunction();
+                if (callee && !call->isCallee(&use) && isRegisterFunction(callee)) {
+                    return true;
+                }
+            } else if (isa<ConstantExpr>(user) || isa<ConstantAggregate>(user) || isa<CastInst>(user)) {
+                if (isAddressExported(user, visited)) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    // Function may be called from outside of the module if it is visible by name or
+    // its address leaves the function, that takes it
+    bool isExported(Function &f) {
+        if (!f.hasLocalLinkage() && !f.hasHiddenVisibility()) {
+            return true;
+        }
+        std::unordered_set<Value*> visited;
+        return isAddressExported(&f, visited);
+    }
+
+    // Functions, that consume or produce interesting structures and can be called from outside
+    std::vector<Function*> findDummyCallTargets(Module &M) {
         std::vector<Function*> todo_list;
         for (auto &f : M.getFunctionList()) {
             if (new_functions.contains(&f)) {
@@ -330,17 +1469,24 @@ private:
             if (f.isDeclaration()) {
                 continue;
             }
-            // Skip hidden functions, they are not visible from outside
-            // TODO: filter functions that are really exported(maybe via pointer)
-            if (f.hasPrivateLinkage()) {
+            if (!functionContainsInterestingStruct(f.getFunctionType())) {
                 continue;
             }
-            if (!functionContainsInterestingStruct(f.getFunctionType())) {
+            // Skip functions, that are not visible from outside
+            if (!isExported(f) || !scope.contains(&f)) {
                 continue;
             }
 
             todo_list.push_back(&f);
         }
+        return todo_list;
+    }
+
+    // Make calls to all functions, that consume or produce interesting structures
+    // to track written and read values. Functions, that cannot be called from outside, are skipped.
+    void propagateSingletons(Module &M) {
+        auto todo_list = findDummyCallTargets(M);
+        std::erase_if(todo_list, [this](Function *f) { return dropped_work.contains(f); });
         size_t l = 0;
         size_t r = todo_list.size();
         outs() << "Making calls for functions [" << l << "; " << r << ")\n";
@@ -352,14 +1498,90 @@ private:
         }
     }
 
-    void implementAllInterestingDeclarations(Module &M) {
+    // Declarations with a spec model or interesting arguments
+    std::vector<Function*> findDeclarationsToImplement(Module &M) {
+        std::vector<Function*> declarations;
         for (auto &f : M.getFunctionList()) {
-            if (functionContainsInterestingStruct(f.getFunctionType()) && f.isDeclaration()) {
-                createStubForDeclaredFunction(M, &f);
+            if (!f.isDeclaration() || f.isIntrinsic()) {
+                continue;
+            }
+            if (extern_models.find(f.getName()) || functionContainsInterestingStruct(f.getFunctionType())) {
+                declarations.push_back(&f);
+            }
+        }
+        return declarations;
+    }
+
+    void implementAllInterestingDeclarations(Module &M) {
+        for (auto *f : findDeclarationsToImplement(M)) {
+            auto *effects = extern_models.find(f->getName());
+            if (effects) {
+                if (auto error = checkModel(f, *effects); !error.empty()) {
+                    fail("Extern spec of " + f->getName().str() + ": " + error);
+                    continue;
+                }
+            }
+            implementDeclaration(M, f, effects, 0);
+            routeDeclarationCalls(M, f, effects);
+        }
+    }
+
+    void implementDeclaration(Module &M, Function *f, const std::vector<extern_effect> *effects, size_t partition) {
+        if (effects) {
+            createModelForDeclaredFunction(M, f, *effects, partition);
+        } else {
+            createStubForDeclaredFunction(M, f, partition);
+        }
+    }
+
+    // Direct calls of the declared function from partitions other than the main one, if it takes or returns hubs
+    std::map<size_t, std::vector<CallBase*>> findPartitionCalls(Function *f) {
+        auto isHubOrPtr = [this](Type *t) {
+            auto *T = getStructType(t);
+            return T && hubs.isHub(T);
+        };
+        auto *f_type = f->getFunctionType();
+        std::map<size_t, std::vector<CallBase*>> partition_calls;
+        if (!isHubOrPtr(f_type->getReturnType()) && std::ranges::none_of(f_type->params(), isHubOrPtr)) {
+            return partition_calls;
+        }
+        for (auto *user : f->users()) {
+            auto *call = dyn_cast<CallBase>(user);
+            if (call && call->getCalledOperand() == f) {
+                if (size_t partition = hubs.getPartition(call->getFunction()); partition != 0) {
+                    partition_calls[partition].push_back(call);
+                }
+            }
+        }
+        return partition_calls;
+    }
+
+    // Hub objects passed to or returned by a declared function belong to the partition of the caller:
+    // callers in other partitions get a copy of the body, that uses singletons and sync helpers of their partition
+    void routeDeclarationCalls(Module &M, Function *f, const std::vector<extern_effect> *effects) {
+        for (auto &[partition, calls] : findPartitionCalls(f)) {
+            auto *copy = Function::Create(f->getFunctionType(), Function::InternalLinkage,
+                                          declarationCopyName(f->getName().str(), partition), M);
+            new_functions.insert(copy);
+            implementDeclaration(M, copy, effects, partition);
+            for (auto *call : calls) {
+                call->setCalledFunction(copy);
             }
         }
     }
 
+    // Interesting type of the global or of its array elements, if it has to be copied to the singleton
+    StructType* getCopiedGlobalType(GlobalVariable &glob) {
+        if (new_globals.contains(&glob) || !scope.contains(&glob)) {
+            return nullptr;
+        }
+        auto ty = glob.getValueType();
+        if (auto *arr_ty = dyn_cast<ArrayType>(ty)) {
+            ty = arr_ty->getElementType();
+        }
+        return type_tracker.isInterestingType(ty) ? dyn_cast<StructType>(ty) : nullptr;
+    }
+
     // Temporal fix for tracking global values directly
     // See: https://github.com/SVF-tools/SVF/issues/1650
     void detectAllGlobals(Module &M) {
@@ -367,24 +1589,19 @@ private:
         builder.SetInsertPoint(global_initializer_bb);
 
         for (auto &glob : M.getGlobalList()) {
-            auto ty = glob.getValueType();
-            auto *arr_ty = dyn_cast<ArrayType>(ty);
-            if (type_tracker.isInterestingType(ty)) {
-                auto *type = dyn_cast<StructType>(ty);
-                auto singleton = singletons[type];
-                if (&glob == singleton) {
-                    continue;
-                }
-                // obj -> singleton
-                copyStructBetweenPointers(M, builder, type, &glob, singleton);
-            } else if (arr_ty && type_tracker.isInterestingType(arr_ty->getElementType())) {
-                auto *type = dyn_cast<StructType>(arr_ty->getElementType());
-                auto singleton = singletons[type];
-
+            auto *type = getCopiedGlobalType(glob);
+            if (!type || dropped_work.contains(&glob)) {
+                continue;
+            }
+            auto singleton = getSingleton(type, &glob);
+            if (auto *arr_ty = dyn_cast<ArrayType>(glob.getValueType())) {
                 for (size_t i = 0; i < arr_ty->getNumElements(); i++) {
                     auto *gep = builder.CreateConstGEP1_64(arr_ty, &glob, i);
                     copyStructBetweenPointers(M, builder, type, gep, singleton);
                 }
+            } else {
+                // obj -> singleton
+                copyStructBetweenPointers(M, builder, type, &glob, singleton);
             }
         }
         outs().flush();
@@ -393,75 +1610,161 @@ private:
     // Iterate over all structures and instrument all interesting fields
     // In case of function pointer - create a stub for it and store it into the singleton
     void fillSingletons(Module &M) {
+        IRBuilder<> builder(M.getContext());
+        builder.SetInsertPoint(global_initializer_bb);
         for (auto interesting_t : type_tracker.getInterestingTypes()) {
             // Dummy object is already created for this type
-            for (size_t i = 0; i < interesting_t->getNumElements(); i++) {
-                auto field = interesting_t->getElementType(i);
-                if (isFunctionPointer(field)) {
-                    createStubFunction(M, interesting_t, i);
+            size_t partitions = hubs.isHub(interesting_t) ? hubs.getPartitionCount() : 1;
+            for (size_t partition = 0; partition < partitions; partition++) {
+                for (size_t i = 0; i < interesting_t->getNumElements(); i++) {
+                    auto field = interesting_t->getElementType(i);
+                    if (isFunctionPointer(field) && !dropped_stubs.contains({interesting_t, i})) {
+                        createStubFunction(M, interesting_t, i, partition);
+                    }
                 }
+                initializeStructureFields(M, interesting_t, partition);
+            }
+        }
+        copyNestedStructs(M);
+        for (auto interesting_t : type_tracker.getInterestingTypes()) {
+            size_t partitions = hubs.isHub(interesting_t) ? hubs.getPartitionCount() : 1;
+            // The main singleton collects values of all partitions, so shared code sees all of them.
+            // No copies back: partitions would be merged through it(values written only by shared code are lost)
+            for (size_t partition = 1; partition < partitions; partition++) {
+                copyStructBetweenPointers(M, builder, interesting_t,
+                                          getPartitionSingleton(interesting_t, partition), singletons[interesting_t]);
             }
-            initializeStructureFields(M, interesting_t);
         }
     }
 
-    // This field is interesting, initialize it
-    // In case of function pointer store the corresponding stub for it
-    void initializeStructureFields(Module &M, StructType *T) {
-        // Used for nested interesting structs
+    // Embedded interesting structs share data with singletons of their types.
+    // Outer-to-inner copies are emitted top-down and inner-to-outer copies bottom-up over the embedding order,
+    // so a written value passes the whole nest in one sweep.
+    void copyNestedStructs(Module &M) {
         IRBuilder<> builder(M.getContext());
         builder.SetInsertPoint(global_initializer_bb);
+        auto copyFields = [&](StructType *T, bool to_inner) {
+            size_t partitions = hubs.isHub(T) ? hubs.getPartitionCount() : 1;
+            for (size_t partition = 0; partition < partitions; partition++) {
+                for (size_t i = 0; i < T->getNumElements(); i++) {
+                    auto *field_type = T->getElementType(i);
+                    if (!type_tracker.isInterestingType(field_type)) {
+                        continue;
+                    }
+                    auto subtype_singleton = getPartitionSingleton(dyn_cast<StructType>(field_type), partition);
+                    Value *ptr_gep = builder.CreateStructGEP(T, getPartitionSingleton(T, partition), i);
+                    if (to_inner) {
+                        // Store written values into the underling singleton
+                        copyStructBetweenPointers(M, builder, field_type, ptr_gep, subtype_singleton);
+                    } else {
+                        // Extract written values from underlying singleton to the outer structure
+                        copyStructBetweenPointers(M, builder, field_type, subtype_singleton, ptr_gep);
+                    }
+                }
+            }
+        };
+        auto &order = type_tracker.getEmbeddingOrder();
+        for (auto T = order.rbegin(); T != order.rend(); T++) {
+            copyFields(*T, true);
+        }
+        for (auto *T : order) {
+            copyFields(T, false);
+        }
+    }
 
+    // This field is interesting, initialize it
+    // In case of function pointer store the corresponding stub for it
+    // Partition objects use stubs and nested singletons of the same partition
+    // Nested interesting structs are zero-initialized and filled by copyNestedStructs
+    void initializeStructureFields(Module &M, StructType *T, size_t partition = 0) {
         std::vector<Constant*> new_init;
+        auto *singleton = getPartitionSingleton(T, partition);
 
         for (size_t i = 0; i < T->getNumElements(); i++) {
             auto field_type = T->getElementType(i);
             if (isFunctionPointer(field_type)) {
-                new_init.push_back(function_stubs[{T, i}]);
+                auto *stub = getPartitionStub(T, i, partition);
+                new_init.push_back(stub ? stub : Constant::getNullValue(field_type));
             } else if (type_tracker.isInterestingType(field_type)) {
                 // Zero-initialize field in struct definition
                 new_init.push_back(Constant::getNullValue(field_type));
-
-                // Share data between singleton and this field
-                auto subtype_singleton = singletons[dyn_cast<StructType>(field_type)];
-                Value *ptr_gep = builder.CreateStructGEP(T, singletons[T], i);
-                // Store written values into the underling singleton
-                copyStructBetweenPointers(M, builder, field_type, ptr_gep, subtype_singleton);
-                // Extract written values from underlying singleton to the outer structure
-                copyStructBetweenPointers(M, builder, field_type, subtype_singleton, ptr_gep);
             } else if (type_tracker.isPtrToInterestingType(field_type)) {
-                auto subtype_singleton = singletons[
-                        dyn_cast<StructType>(field_type->getNonOpaquePointerElementType())
-                ];
+                auto subtype_singleton = getPartitionSingleton(
+                        dyn_cast<StructType>(field_type->getNonOpaquePointerElementType()), partition
+                );
                 new_init.push_back(subtype_singleton);
             } else {
                 new_init.push_back(Constant::getNullValue(field_type));
             }
         }
 
-        singletons[T]->setInitializer(
+        singleton->setInitializer(
             ConstantStruct::get(T, new_init)
         );
     }
 
     // Create a singleton with a given type and no fields
     // Created objects are marked external to avoid initialization
+    // Hub types get an object for every partition
     GlobalVariable* createSingleton(Module &M, StructType *T) {
         if (singletons.contains(T)) {
             return singletons[T];
         }
-        // Mark is as external to avoid initializing structure
-        auto *var = new GlobalVariable(
-                M, T, false, GlobalValue::InternalLinkage,
-                ConstantStruct::getNullValue(T), // Definition is required for internal linkage
-                structSingletonName(T->getName().operator std::string())
+        size_t partitions = hubs.isHub(T) ? hubs.getPartitionCount() : 1;
+        for (size_t partition = 0; partition < partitions; partition++) {
+            // Mark is as external to avoid initializing structure
+            auto *var = new GlobalVariable(
+                    M, T, false, GlobalValue::InternalLinkage,
+                    ConstantStruct::getNullValue(T), // Definition is required for internal linkage
+                    structSingletonName(T->getName().operator std::string(), partition)
+            );
+            new_globals.insert(var);
+            if (partition == 0) {
+                singletons[T] = var;
+            }
+            if (partitions > 1) {
+                hub_singletons[T].push_back(var);
+            }
+        }
+        return singletons[T];
+    }
+
+    // Helper, that copies the object to the singleton of its type and back. Sites, that both keep and fill
+    // an object, call it instead of emitting their own pair of copies, so every type has one such pair.
+    // Hub types have a helper per partition
+    Function* getSyncFunction(Module &M, StructType *T, size_t partition = 0) {
+        if (!hubs.isHub(T)) {
+            partition = 0;
+        }
+        auto &sync = sync_functions[{T, partition}];
+        if (sync) {
+            return sync;
+        }
+        LLVMContext &ctx = M.getContext();
+        sync = Function::Create(
+                FunctionType::get(Type::getVoidTy(ctx), {T->getPointerTo()}, false),
+                Function::ExternalLinkage,
+                syncFuncName(T->getName().str(), partition),
+                M
         );
-        singletons[T] = var;
-        return var;
+        IRBuilder<> builder(BasicBlock::Create(ctx, "", sync));
+        auto *singleton = getPartitionSingleton(T, partition);
+        copyStructBetweenPointers(M, builder, T, sync->getArg(0), singleton);
+        copyStructBetweenPointers(M, builder, T, singleton, sync->getArg(0));
+        builder.CreateRetVoid();
+        new_functions.insert(sync);
+        return sync;
+    }
+
+    // Sync the object, ptr is a pointer to an interesting type
+    void createSyncCall(Module &M, IRBuilder<> &builder, Value *ptr, size_t partition = 0) {
+        auto *sync = getSyncFunction(M, dereferenceStructPtr(ptr->getType()), partition);
+        auto *param_type = sync->getFunctionType()->getParamType(0);
+        builder.CreateCall(sync, {builder.CreatePointerCast(ptr, param_type)});
     }
 
     // Implement all declared functions to collect passed values
-    void createStubForDeclaredFunction(Module &M, Function *f) {
+    void createStubForDeclaredFunction(Module &M, Function *f, size_t partition = 0) {
         auto f_type = f->getFunctionType();
         IRBuilder<> builder(M.getContext());
         BasicBlock *bb = BasicBlock::Create(M.getContext(), "", f);
@@ -470,14 +1773,7 @@ private:
         size_t i = 0;
         for (auto arg : f_type->params()) {
             if (type_tracker.isPtrToInterestingType(arg)) {
-                copyStructBetweenPointers(
-                    M, builder, dereferenceStructPtr(arg),
-                    f->getArg(i), singletons[dereferenceStructPtr(arg)]
-                );
-                copyStructBetweenPointers(
-                        M, builder, dereferenceStructPtr(arg),
-                        singletons[dereferenceStructPtr(arg)], f->getArg(i)
-                );
+                createSyncCall(M, builder, f->getArg(i), partition);
             } else if (type_tracker.isInterestingType(arg)) {
                 outs() << "WARNING: Function getting interesting type by value!!\n";
                 outs().flush();
@@ -487,22 +1783,122 @@ private:
         if (f_type->getReturnType()->isVoidTy()) {
             builder.CreateRetVoid();
         } else {
-            auto ret_value = constructTypeValue(f_type->getReturnType(), builder);
+            auto ret_value = constructPartitionValue(f_type->getReturnType(), builder, partition);
             builder.CreateRet(ret_value);
         }
     }
 
+    // Error message if the spec doesn't fit the declaration, nothing is created then
+    static std::string checkModel(Function *f, const std::vector<extern_effect> &effects) {
+        auto *ret_type = f->getReturnType();
+        // Pointers are converted, other types must match
+        auto convertible = [](Type *from, Type *to) {
+            return from == to || (from->isPointerTy() && to->isPointerTy());
+        };
+        for (auto &effect : effects) {
+            bool returns = effect.kind == extern_effect::return_arg || effect.kind == extern_effect::return_singleton ||
+                           effect.kind == extern_effect::return_null;
+            if (ret_type->isVoidTy() && returns) {
+                return "function returns void";
+            }
+            if (effect.kind != extern_effect::ignore && effect.kind != extern_effect::return_singleton &&
+                    effect.kind != extern_effect::return_null && effect.arg >= f->arg_size()) {
+                return "no argument " + std::to_string(effect.arg);
+            }
+            if (effect.kind == extern_effect::return_arg && !convertible(f->getArg(effect.arg)->getType(), ret_type)) {
+                return "type mismatch";
+            }
+            if (effect.kind == extern_effect::store) {
+                if (effect.dst_arg >= f->arg_size()) {
+                    return "no argument " + std::to_string(effect.dst_arg);
+                }
+                auto *T = dereferenceStructPtr(f->getArg(effect.dst_arg)->getType());
+                if (!T || effect.field >= T->getNumElements()) {
+                    return "no field " + std::to_string(effect.field) + " in argument " +
+                           std::to_string(effect.dst_arg);
+                }
+                if (!convertible(f->getArg(effect.arg)->getType(), T->getElementType(effect.field))) {
+                    return "type mismatch";
+                }
+            }
+        }
+        return "";
+    }
+
+    // Implement a declared function with flows listed in the spec only, the spec is checked by checkModel
+    void createModelForDeclaredFunction(Module &M, Function *f, const std::vector<extern_effect> &effects,
+                                        size_t partition = 0) {
+        auto *ret_type = f->getReturnType();
+        IRBuilder<> builder(M.getContext());
+        BasicBlock *bb = BasicBlock::Create(M.getContext(), "", f);
+        builder.SetInsertPoint(bb);
+
+        auto getArg = [f](unsigned idx) {
+            return f->getArg(idx);
+        };
+        auto castTo = [&](Value *v, Type *t) {
+            return v->getType() == t ? v : builder.CreateBitCast(v, t);
+        };
+
+        Value *ret_value = nullptr;
+        for (auto &effect : effects) {
+            switch (effect.kind) {
+                case extern_effect::ignore:
+                    break;
+                case extern_effect::keep:
+                case extern_effect::fill:
+                case extern_effect::sync: {
+                    auto *arg = getArg(effect.arg);
+                    auto *T = dereferenceStructPtr(arg->getType());
+                    if (!T || !type_tracker.isInterestingType(T)) {
+                        // Nothing is tracked in this object
+                        break;
+                    }
+                    if (effect.kind == extern_effect::sync) {
+                        createSyncCall(M, builder, arg, partition);
+                    } else if (effect.kind == extern_effect::keep) {
+                        copyStructBetweenPointers(M, builder, T, arg, getPartitionSingleton(T, partition));
+                    } else {
+                        copyStructBetweenPointers(M, builder, T, getPartitionSingleton(T, partition), arg);
+                    }
+                    break;
+                }
+                case extern_effect::return_arg:
+                    ret_value = castTo(getArg(effect.arg), ret_type);
+                    break;
+                case extern_effect::return_singleton:
+                    ret_value = constructPartitionValue(ret_type, builder, partition);
+                    break;
+                case extern_effect::return_null:
+                    ret_value = Constant::getNullValue(ret_type);
+                    break;
+                case extern_effect::store: {
+                    auto *dst = getArg(effect.dst_arg);
+                    auto *T = dereferenceStructPtr(dst->getType());
+                    auto *field_ptr = builder.CreateStructGEP(T, dst, effect.field);
+                    builder.CreateStore(castTo(getArg(effect.arg), T->getElementType(effect.field)), field_ptr);
+                    break;
+                }
+            }
+        }
+        if (ret_type->isVoidTy()) {
+            builder.CreateRetVoid();
+        } else {
+            builder.CreateRet(ret_value ? ret_value : constructPartitionValue(ret_type, builder, partition));
+        }
+    }
+
     // Create a stub function, that will track field_idx field in a StructType T
     // This function reads corresponding field from the singleton and calls it
     // Its type is the same as in the structure, so arguments are just forwarded and the same return value is used
-    Function* createStubFunction(Module &M, StructType *T, size_t field_idx) {
-        auto name = funcStubName(T->getName().operator std::string(), field_idx);
+    // Stubs of hub partitions read the field from the partition singleton
+    Function* createStubFunction(Module &M, StructType *T, size_t field_idx, size_t partition = 0) {
+        auto name = funcStubName(T->getName().operator std::string(), field_idx, partition);
         FunctionType *stub_type = dereferenceFPtr(T->getTypeAtIndex(field_idx));
         if (!stub_type) {
-            outs() << "createStubFunction: struct " << T->getName() << " does not have function pointer at field ";
-            outs() << field_idx << "\n";
-            outs().flush();
-            exit(1);
+            fail("createStubFunction: struct " + T->getName().str() + " does not have function pointer at field " +
+                 std::to_string(field_idx));
+            return nullptr;
         }
         Function *f = Function::Create(
             stub_type, Function::ExternalLinkage,
@@ -519,22 +1915,164 @@ private:
 
         builder.SetInsertPoint(body);
 
-        Value *ptr_gep = builder.CreateStructGEP(T, singletons[T], field_idx);
+        Value *ptr_gep = builder.CreateStructGEP(T, getPartitionSingleton(T, partition), field_idx);
         Value *fptr = builder.CreateLoad(stub_type->getPointerTo(), ptr_gep);
-        // fptr contains field value from singleton
-        Value* call = builder.CreateCall(stub_type, fptr, args);
 
-        if (stub_type->getReturnType()->isVoidTy()) {
-            builder.CreateRetVoid();
+        std::optional<field_targets::targets_t> known_targets;
+        if (DevirtualizeStubs.getValue()) {
+            known_targets = stored_functions.getClosedTargets(T, field_idx);
+        }
+        if (known_targets) {
+            createDirectCalls(M, f, fptr, args, *known_targets, builder);
         } else {
-            builder.CreateRet(call);
+            // fptr contains field value from singleton
+            Value* call = builder.CreateCall(stub_type, fptr, args);
+
+            if (stub_type->getReturnType()->isVoidTy()) {
+                builder.CreateRetVoid();
+            } else {
+                builder.CreateRet(call);
+            }
         }
 
-        function_stubs[{T, field_idx}] = f;
+        if (partition == 0) {
+            function_stubs[{T, field_idx}] = f;
+        }
+        stub_fields[f] = {T, field_idx};
+        if (hubs.isHub(T)) {
+            auto &partition_stubs = hub_stubs[{T, field_idx}];
+            partition_stubs.resize(hubs.getPartitionCount());
+            partition_stubs[partition] = f;
+        }
         new_functions.insert(f);
         return f;
     }
 
+    // Number instructions of input bodies before any rewrite, instructions added later get no key
+    void recordInputIndex(Module &M) {
+        for (auto &f : M) {
+            uint32_t inst_idx = 0;
+            for (auto &bb : f) {
+                for (auto &inst : bb) {
+                    if (isIndexedInstruction(inst)) {
+                        input_index[&inst] = inst_idx++;
+                    }
+                }
+            }
+        }
+    }
+
+    // Save generated symbols and indirect call sites, so other tools don't need to parse names back
+    // Call sites are identified by the function and the instruction position in its input body
+    void writeSidecarIndex(Module &M, const std::string &path) {
+        sidecar_index_writer index;
+        for (auto *T : type_tracker.getInterestingTypes()) {
+            auto singleton = singletons.find(T);
+            if (singleton == singletons.end()) {
+                // Dropped by the cleanup
+                continue;
+            }
+            auto type_name = T->getName().str();
+            auto singleton_name = singleton->second->getName().str();
+            index.addField(type_name, SIDECAR_NO_FIELD, singleton_name, "");
+            for (size_t i = 0; i < T->getNumElements(); i++) {
+                if (auto stub = function_stubs.find({T, i}); stub != function_stubs.end()) {
+                    index.addField(type_name, i, singleton_name, stub->second->getName().str());
+                }
+            }
+        }
+        for (auto &f : M) {
+            if (new_functions.contains(&f)) {
+                continue;
+            }
+            for (auto &bb : f) {
+                for (auto &inst : bb) {
+                    auto idx = input_index.find(&inst);
+                    if (idx == input_index.end()) {
+                        continue;
+                    }
+                    uint32_t inst_idx = idx->second;
+                    auto *call = dyn_cast<CallBase>(&inst);
+                    auto field = call ? getCalledField(call) : std::nullopt;
+                    if (auto *callee = call ? call->getCalledOperand()->stripPointerCasts() : nullptr) {
+                        // Indirect call replaced with a stub call
+                        if (auto it = stub_fields.find(dyn_cast<Function>(callee)); it != stub_fields.end()) {
+                            field = it->second;
+                        }
+                    }
+                    if (field) {
+                        if (type_tracker.isInterestingType(field->first)) {
+                            index.addCall(f.getName().str(), inst_idx, field->first->getName().str(), field->second);
+                        }
+                    }
+                }
+            }
+        }
+        if (std::string error; !index.write(path, error)) {
+            fail(error);
+        }
+    }
+
+    // Locations of original functions, their indirect calls(including replaced with stub calls) and stores
+    // of the input. Instruction indices match the sidecar index
+    void writeDebugMap(Module &M, const std::string &path) {
+        debug_map_writer map;
+        for (auto &f : M) {
+            if (new_functions.contains(&f)) {
+                continue;
+            }
+            map.addFunction(f);
+            for (auto &bb : f) {
+                for (auto &inst : bb) {
+                    auto idx = input_index.find(&inst);
+                    if (idx == input_index.end()) {
+                        continue;
+                    }
+                    auto *call = dyn_cast<CallBase>(&inst);
+                    bool indirect_call = call && (call->isIndirectCall() ||
+                            stub_fields.contains(dyn_cast<Function>(call->getCalledOperand()->stripPointerCasts())));
+                    if ((indirect_call || isa<StoreInst>(inst)) && inst.getDebugLoc()) {
+                        map.addSite(f, idx->second, inst.getDebugLoc().get());
+                    }
+                }
+            }
+        }
+        if (std::string error; !map.write(path, error)) {
+            fail(error);
+        }
+    }
+
+    // Field can hold only known functions: compare the loaded pointer with each of them and call it directly
+    // Stub returns a zero value if nothing matched(field is null)
+    void createDirectCalls(Module &M, Function *stub, Value *fptr, const std::vector<Value*> &args,
+                           const field_targets::targets_t &targets, IRBuilder<> &builder) {
+        LLVMContext &ctx = M.getContext();
+        auto *stub_type = stub->getFunctionType();
+        auto createReturn = [&](Value *ret) {
+            if (stub_type->getReturnType()->isVoidTy()) {
+                builder.CreateRetVoid();
+            } else {
+                builder.CreateRet(ret ? ret : Constant::getNullValue(stub_type->getReturnType()));
+            }
+        };
+
+        for (auto *target : targets) {
+            auto *callee = ConstantExpr::getBitCast(target, fptr->getType());
+            auto *call_bb = BasicBlock::Create(ctx, "", stub);
+            auto *next_bb = BasicBlock::Create(ctx, "", stub);
+            builder.CreateCondBr(builder.CreateICmpEQ(fptr, callee), call_bb, next_bb);
+
+            builder.SetInsertPoint(call_bb);
+            Value *call = target->getFunctionType() == stub_type ?
+                    builder.CreateCall(target, args) :
+                    builder.CreateCall(stub_type, callee, args);
+            createReturn(call);
+
+            builder.SetInsertPoint(next_bb);
+        }
+        createReturn(nullptr);
+    }
+
     // Function initializers and finalizers
 
     void createGlobalInitializer(Module &M) {
@@ -580,6 +2118,35 @@ private:
 
 char StructVisitorPass::ID = 0;
 
+ModulePass* createStructVisitorPass(const struct_filter *types, const extern_spec *externs, std::string *error) {
+    return new StructVisitorPass(types, externs, error);
+}
+
+std::optional<extern_spec> loadExternSpec() {
+    if (ExternSpec.empty()) {
+        return std::nullopt;
+    }
+    return extern_spec::fromFile(ExternSpec.getValue());
+}
+
+source_scope loadSourceScope() {
+    return source_scope(
+            std::vector<std::string>(ScopeInclude.begin(), ScopeInclude.end()),
+            std::vector<std::string>(ScopeExclude.begin(), ScopeExclude.end())
+    );
+}
+
+bool isSummarizationEnabled() {
+    return SummarizeBodies.getValue();
+}
+
+std::optional<type_policy> loadTypePolicy() {
+    if (TypePolicy.empty()) {
+        return std::nullopt;
+    }
+    return type_policy::fromFile(TypePolicy.getValue());
+}
+
 static RegisterPass<StructVisitorPass> X("instr", "Instrument Structs Pass",
                                          false /* Only looks at CFG */,
                                          false /* Analysis Pass */);
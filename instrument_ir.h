@@ -0,0 +1,30 @@
+#pragma once
+
+#include <optional>
+#include "llvm/Pass.h"
+#include "extern_spec.h"
+#include "source_scope.h"
+#include "type_policy.h"
+
+using namespace llvm;
+
+class struct_filter;
+
+// Instrumentation pass, configured by its command line options
+// If types are given, they are used instead of a new filter. They must be built for this module or for a module,
+// that it was cloned from, and outlive the pass. Given externs are used instead of -extern-spec.
+// If error is given, a failure is written there instead of exiting and the module must be discarded.
+ModulePass* createStructVisitorPass(const struct_filter *types = nullptr, const extern_spec *externs = nullptr,
+                                    std::string *error = nullptr);
+
+// Policy given by -type-policy, nothing if the option is not set
+std::optional<type_policy> loadTypePolicy();
+
+// Spec given by -extern-spec, nothing if the option is not set
+std::optional<extern_spec> loadExternSpec();
+
+// Scope given by -scope-include and -scope-exclude
+source_scope loadSourceScope();
+
+// True if -summarize-bodies is set
+bool isSummarizationEnabled();
@@ -0,0 +1,222 @@
+#include <set>
+#include "ir_metrics.h"
+#include "llvm/Pass.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "util.h"
+
+ir_metrics ir_metrics::operator-(const ir_metrics &other) const {
+    ir_metrics res;
+    res.instructions = instructions - other.instructions;
+    res.functions = functions - other.functions;
+    res.globals = globals - other.globals;
+    res.memcpy_bytes = memcpy_bytes - other.memcpy_bytes;
+    res.addr_of = addr_of - other.addr_of;
+    res.copy = copy - other.copy;
+    res.load = load - other.load;
+    res.store = store - other.store;
+    res.field = field - other.field;
+    return res;
+}
+
+bool ir_metrics::empty() const {
+    return instructions == 0 && functions == 0 && globals == 0 && memcpy_bytes == 0 &&
+           addr_of == 0 && copy == 0 && load == 0 && store == 0 && field == 0;
+}
+
+void ir_metrics::print(raw_ostream &out, bool with_sizes) const {
+    if (with_sizes) {
+        out << "insts " << instructions << ", funcs " << functions << ", globals " << globals << ", ";
+    }
+    out << "memcpy bytes " << memcpy_bytes
+        << "; constraints: addr " << addr_of << ", copy " << copy << ", load " << load
+        << ", store " << store << ", field " << field;
+}
+
+metrics_collector::metrics_collector(struct_filter *type_tracker): type_tracker(type_tracker) {}
+
+// Memcpy is modelled as a load and a store per pointer in the copied object
+int64_t metrics_collector::countPointerFields(Type *t) {
+    if (t->isPointerTy()) {
+        return 1;
+    }
+    if (auto *arr = dyn_cast<ArrayType>(t)) {
+        return arr->getNumElements() * countPointerFields(arr->getElementType());
+    }
+    int64_t res = 0;
+    for (auto *sub : t->subtypes()) {
+        res += countPointerFields(sub);
+    }
+    return res;
+}
+
+// Per type numbers are collected for interesting types only, the rest goes to totals
+ir_metrics& metrics_collector::typeMetrics(Type *ptr_type) {
+    auto *st = getStructType(ptr_type);
+    if (!st || !type_tracker || !type_tracker->isInterestingType(st)) {
+        return untracked;
+    }
+    return per_type[st];
+}
+
+void metrics_collector::collectInstruction(Instruction &inst) {
+    total.instructions++;
+    if (isa<AllocaInst>(&inst)) {
+        total.addr_of++;
+        typeMetrics(inst.getType()).addr_of++;
+    } else if (auto *load = dyn_cast<LoadInst>(&inst)) {
+        if (load->getType()->isPointerTy()) {
+            total.load++;
+            typeMetrics(load->getPointerOperandType()).load++;
+        }
+    } else if (auto *store = dyn_cast<StoreInst>(&inst)) {
+        if (store->getValueOperand()->getType()->isPointerTy()) {
+            total.store++;
+            typeMetrics(store->getPointerOperandType()).store++;
+        }
+    } else if (auto *gep = dyn_cast<GetElementPtrInst>(&inst)) {
+        if (getAccessedField(gep)) {
+            total.field++;
+            typeMetrics(gep->getPointerOperandType()).field++;
+        } else {
+            total.copy++;
+        }
+    } else if (auto *phi = dyn_cast<PHINode>(&inst)) {
+        if (phi->getType()->isPointerTy()) {
+            total.copy += phi->getNumIncomingValues();
+            typeMetrics(phi->getType()).copy += phi->getNumIncomingValues();
+        }
+    } else if (isa<CastInst>(&inst) || isa<SelectInst>(&inst)) {
+        if (inst.getType()->isPointerTy()) {
+            int64_t copies = isa<SelectInst>(&inst) ? 2 : 1;
+            total.copy += copies;
+            typeMetrics(inst.getType()).copy += copies;
+        }
+    } else if (auto *memcpy = dyn_cast<MemTransferInst>(&inst)) {
+        auto *len = dyn_cast<ConstantInt>(memcpy->getLength());
+        auto *src_type = memcpy->getRawSource()->stripPointerCasts()->getType()->getNonOpaquePointerElementType();
+        int64_t ptr_fields = countPointerFields(src_type);
+        auto &type_metrics = typeMetrics(memcpy->getRawSource()->stripPointerCasts()->getType());
+        if (len) {
+            total.memcpy_bytes += len->getZExtValue();
+            type_metrics.memcpy_bytes += len->getZExtValue();
+        }
+        total.load += ptr_fields;
+        total.store += ptr_fields;
+        type_metrics.load += ptr_fields;
+        type_metrics.store += ptr_fields;
+    } else if (auto *call = dyn_cast<CallBase>(&inst)) {
+        // Pointer arguments and return values are copied between caller and callee
+        for (auto &arg : call->args()) {
+            if (arg->getType()->isPointerTy()) {
+                total.copy++;
+                typeMetrics(arg->getType()).copy++;
+            }
+        }
+        if (call->getType()->isPointerTy()) {
+            total.copy++;
+            typeMetrics(call->getType()).copy++;
+        }
+    }
+}
+
+void metrics_collector::collectConstantExpr(Constant *c) {
+    auto *gep = dyn_cast<GEPOperator>(c);
+    if (!gep || !isa<ConstantExpr>(c)) {
+        return;
+    }
+    if (getAccessedField(gep)) {
+        total.field++;
+        typeMetrics(gep->getPointerOperandType()).field++;
+    } else {
+        total.copy++;
+    }
+}
+
+void metrics_collector::collect(Module &M) {
+    total = ir_metrics();
+    untracked = ir_metrics();
+    per_type.clear();
+    // Every distinct constant expression is counted once, however many operands refer to it
+    constant_walker constant_exprs([this](Constant *c) {
+        collectConstantExpr(c);
+        return c;
+    });
+    for (auto &glob : M.globals()) {
+        total.globals++;
+        total.addr_of++;
+        typeMetrics(glob.getType()).addr_of++;
+        if (glob.hasInitializer()) {
+            constant_exprs.walk(glob.getInitializer());
+        }
+    }
+    for (auto &f : M) {
+        if (f.isIntrinsic()) {
+            continue;
+        }
+        total.functions++;
+        total.addr_of++;
+        for (auto &bb : f) {
+            for (auto &inst : bb) {
+                collectInstruction(inst);
+                for (auto &op : inst.operands()) {
+                    if (auto *c = dyn_cast<Constant>(op.get())) {
+                        constant_exprs.walk(c);
+                    }
+                }
+            }
+        }
+    }
+}
+
+void metrics_collector::printDelta(raw_ostream &out, const std::string &title, const metrics_collector &before) const {
+    out << "[metrics] " << title << ": ";
+    (total - before.total).print(out);
+    out << "\n";
+    // Types may be missing in either snapshot, e.g. when all their uses were removed
+    std::set<StructType*, struct_name_less> types;
+    for (auto *metrics : {&per_type, &before.per_type}) {
+        for (auto &[type, _] : *metrics) {
+            types.insert(type);
+        }
+    }
+    auto metricsOf = [](const auto &metrics, StructType *type) {
+        auto it = metrics.find(type);
+        return it == metrics.end() ? ir_metrics() : it->second;
+    };
+    for (auto *type : types) {
+        auto delta = metricsOf(per_type, type) - metricsOf(before.per_type, type);
+        if (delta.empty()) {
+            continue;
+        }
+        out << "[metrics]     " << type->getName() << ": ";
+        delta.print(out, false);
+        out << "\n";
+    }
+}
+
+// Standalone analysis: run it before and after the instrumentation to compare modules
+struct IRMetricsPass : public ModulePass {
+    IRMetricsPass(): ModulePass(ID) {}
+
+    bool runOnModule(Module &M) override {
+        struct_filter type_tracker(&M);
+        metrics_collector metrics(&type_tracker);
+        metrics.collect(M);
+        metrics.printDelta(outs(), M.getModuleIdentifier(), metrics_collector(nullptr));
+        outs().flush();
+        return false;
+    }
+
+    void getAnalysisUsage(AnalysisUsage &AU) const override {
+        AU.setPreservesAll();
+    }
+
+    static char ID;
+};
+
+char IRMetricsPass::ID = 0;
+
+static RegisterPass<IRMetricsPass> X("ir-metrics", "Report IR size and estimated constraints",
+                                     false /* Only looks at CFG */,
+                                     true /* Analysis Pass */);
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <map>
+#include "llvm/IR/IRBuilder.h"
+#include "struct_filter.h"
+
+using namespace llvm;
+
+// Module size and estimated Andersen-style constraint counts
+// Fields are signed, so differences between two snapshots can be stored too
+struct ir_metrics {
+    int64_t instructions = 0;
+    int64_t functions = 0;
+    int64_t globals = 0;
+    int64_t memcpy_bytes = 0;
+
+    int64_t addr_of = 0;
+    int64_t copy = 0;
+    int64_t load = 0;
+    int64_t store = 0;
+    int64_t field = 0;
+
+    ir_metrics operator-(const ir_metrics &other) const;
+
+    [[nodiscard]] bool empty() const;
+
+    // Sizes are not attributed to types, so they may be omitted
+    void print(raw_ostream &out, bool with_sizes = true) const;
+};
+
+// Collects module totals and constraints attributed to interesting types
+class metrics_collector {
+public:
+    explicit metrics_collector(struct_filter *type_tracker);
+
+    void collect(Module &M);
+
+    // Print totals and per type numbers of (this - before)
+    void printDelta(raw_ostream &out, const std::string &title, const metrics_collector &before) const;
+
+    ir_metrics total;
+    std::map<StructType*, ir_metrics, struct_name_less> per_type;
+private:
+    struct_filter *type_tracker;
+    // Constraints not attributed to any interesting type
+    ir_metrics untracked;
+
+    ir_metrics& typeMetrics(Type *ptr_type);
+
+    void collectInstruction(Instruction &inst);
+
+    // GEP constant expressions are field or copy constraints like GEP instructions
+    void collectConstantExpr(Constant *c);
+
+    static int64_t countPointerFields(Type *t);
+};
@@ -0,0 +1,201 @@
+#include "mlta.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+
+static cl::opt<std::string> MLTAOutput(
+        "mlta-out",
+        cl::desc("Write resolved targets of indirect calls to this file"),
+        cl::init("")
+);
+
+bool mlta_resolver::path_less::operator()(const field_path_t &a, const field_path_t &b) const {
+    return std::lexicographical_compare(a.begin(), a.end(), b.begin(), b.end(), struct_field_less());
+}
+
+// The shorter path must be the end of the longer one
+static bool compatiblePaths(const mlta_resolver::field_path_t &a, const mlta_resolver::field_path_t &b) {
+    size_t common = std::min(a.size(), b.size());
+    return std::equal(a.end() - common, a.end(), b.end() - common);
+}
+
+mlta_resolver::mlta_resolver(Module *M, const struct_filter &type_tracker) : flows(*M) {
+    for (auto &[path, val] : flows.getFieldStores()) {
+        addStoredValue(path, val);
+    }
+    for (auto *root : flows.getEscapeRoots()) {
+        markEscaped(root, type_tracker);
+    }
+    for (auto &path : flows.getEscapedFields()) {
+        getLayer(path).open = true;
+    }
+    for (auto &f : *M) {
+        if (f.hasAddressTaken()) {
+            signature_targets[f.getFunctionType()].push_back(&f);
+        }
+    }
+}
+
+mlta_resolver::layer_info &mlta_resolver::getLayer(const field_path_t &path) {
+    auto [it, inserted] = layers.try_emplace(path);
+    if (inserted) {
+        paths_by_field[path.back()].push_back(path);
+    }
+    return it->second;
+}
+
+void mlta_resolver::addStoredValue(const field_path_t &path, Value *val) {
+    auto &layer = getLayer(path);
+    val = val->stripPointerCasts();
+    if (auto *f = dyn_cast<Function>(val)) {
+        layer.targets.insert(f);
+    } else if (isa<ConstantPointerNull>(val) || isa<UndefValue>(val)) {
+        // Nothing is stored
+    } else if (auto *load = dyn_cast<LoadInst>(val)) {
+        auto source = getAccessedFieldPath(load->getPointerOperand());
+        if (source.empty()) {
+            layer.open = true;
+        } else {
+            layer.sources.insert(source);
+        }
+    } else {
+        layer.open = true;
+    }
+}
+
+// Escaped object may get any value in any field, this includes embedded and pointed structs
+void mlta_resolver::markEscaped(StructType *T, const struct_filter &type_tracker) {
+    if (!T || !escaped_types.insert(T).second) {
+        return;
+    }
+    for (auto *child : type_tracker.getChildren(T)) {
+        markEscaped(child, type_tracker);
+    }
+}
+
+bool mlta_resolver::collectTargets(const field_path_t &path, targets_t &res,
+                                   std::set<field_path_t, path_less> &visited) const {
+    auto [T, idx] = path.back();
+    auto *fptr_type = T->getElementType(idx);
+    if (escaped_types.contains(T) || flows.isOpenType(fptr_type)) {
+        return false;
+    }
+    auto it = paths_by_field.find(path.back());
+    if (it == paths_by_field.end()) {
+        return false;
+    }
+    bool recorded_any = false;
+    for (auto &recorded : it->second) {
+        if (!compatiblePaths(path, recorded)) {
+            continue;
+        }
+        recorded_any = true;
+        if (!visited.insert(recorded).second) {
+            continue;
+        }
+        auto &layer = layers.at(recorded);
+        if (layer.open) {
+            return false;
+        }
+        res.insert(layer.targets.begin(), layer.targets.end());
+        for (auto &source : layer.sources) {
+            if (!collectTargets(source, res, visited)) {
+                return false;
+            }
+        }
+    }
+    if (auto *untyped = flows.getUntypedTargets(fptr_type)) {
+        res.insert(untyped->begin(), untyped->end());
+    }
+    return recorded_any;
+}
+
+mlta_resolver::targets_t mlta_resolver::resolve(CallBase *call) const {
+    targets_t res;
+    if (auto *load = dyn_cast<LoadInst>(call->getCalledOperand()->stripPointerCasts())) {
+        auto path = getAccessedFieldPath(load->getPointerOperand());
+        std::set<field_path_t, path_less> visited;
+        if (!path.empty() && collectTargets(path, res, visited)) {
+            layer_resolved++;
+            return res;
+        }
+        res.clear();
+    }
+    signature_resolved++;
+    if (auto it = signature_targets.find(call->getFunctionType()); it != signature_targets.end()) {
+        res.insert(it->second.begin(), it->second.end());
+    }
+    return res;
+}
+
+size_t mlta_resolver::getLayerResolved() const {
+    return layer_resolved;
+}
+
+size_t mlta_resolver::getSignatureResolved() const {
+    return signature_resolved;
+}
+
+// Every indirect call is written as "function#instruction index" followed by its targets
+// Instruction index is the same as in the sidecar index
+struct MLTAPass : public ModulePass {
+    MLTAPass(): ModulePass(ID) {}
+
+    bool runOnModule(Module &M) override {
+        struct_filter type_tracker(&M);
+        mlta_resolver resolver(&M, type_tracker);
+
+        std::error_code ec;
+        std::unique_ptr<raw_fd_ostream> file;
+        if (!MLTAOutput.empty()) {
+            file = std::make_unique<raw_fd_ostream>(MLTAOutput.getValue(), ec, sys::fs::OF_Text);
+            if (ec) {
+                outs() << "Cannot write " << MLTAOutput << ": " << ec.message() << "\n";
+                outs().flush();
+                exit(1);
+            }
+        }
+        size_t total_targets = 0;
+        for (auto &f : M) {
+            size_t inst_idx = 0;
+            for (auto &bb : f) {
+                for (auto &inst : bb) {
+                    if (!isIndexedInstruction(inst)) {
+                        continue;
+                    }
+                    auto *call = dyn_cast<CallBase>(&inst);
+                    if (call && call->isIndirectCall()) {
+                        auto targets = resolver.resolve(call);
+                        total_targets += targets.size();
+                        if (file) {
+                            *file << f.getName() << "#" << inst_idx;
+                            for (auto *target : targets) {
+                                *file << " " << target->getName();
+                            }
+                            *file << "\n";
+                        }
+                    }
+                    inst_idx++;
+                }
+            }
+        }
+        outs() << "Indirect calls resolved by fields: " << resolver.getLayerResolved() << "\n";
+        outs() << "Indirect calls resolved by signatures: " << resolver.getSignatureResolved() << "\n";
+        outs() << "Total targets: " << total_targets << "\n";
+        outs().flush();
+        return false;
+    }
+
+    void getAnalysisUsage(AnalysisUsage &AU) const override {
+        AU.setPreservesAll();
+    }
+
+    static char ID;
+};
+
+char MLTAPass::ID = 0;
+
+static RegisterPass<MLTAPass> X("mlta", "Resolve indirect calls by struct field paths",
+                                false /* Only looks at CFG */,
+                                true /* Analysis Pass */);
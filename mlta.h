@@ -0,0 +1,65 @@
+#pragma once
+
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include "llvm/ADT/SetVector.h"
+#include "llvm/IR/IRBuilder.h"
+#include "fptr_flows.h"
+#include "struct_filter.h"
+
+using namespace llvm;
+
+// Multi-layer type analysis: a fast alternative to full pointer analysis for indirect calls.
+// Functions are recorded with the whole field path they are stored into(outer struct first),
+// a call through a loaded field gets functions of all compatible paths: one path must be a suffix of another,
+// and functions stored through untyped pointers of its type.
+// Call sites not loading from a field, fields without a compatible path, fields with unknown values
+// and escaped types are resolved by the function signature.
+class mlta_resolver {
+public:
+    using targets_t = SetVector<Function*>;
+    using field_t = std::pair<StructType*, size_t>;
+    using field_path_t = std::vector<field_t>;
+
+    explicit mlta_resolver(Module *M, const struct_filter &type_tracker);
+
+    // Possible callees of an indirect call
+    [[nodiscard]] targets_t resolve(CallBase *call) const;
+
+    // Number of calls resolved by field paths and by signatures
+    [[nodiscard]] size_t getLayerResolved() const;
+
+    [[nodiscard]] size_t getSignatureResolved() const;
+private:
+    struct path_less {
+        bool operator()(const field_path_t &a, const field_path_t &b) const;
+    };
+
+    struct layer_info {
+        targets_t targets;
+        // Values are copied from these paths
+        std::set<field_path_t, path_less> sources;
+        // Unknown value is stored
+        bool open = false;
+    };
+
+    std::map<field_path_t, layer_info, path_less> layers;
+    // Recorded paths by the innermost field
+    std::map<field_t, std::vector<field_path_t>, struct_field_less> paths_by_field;
+    std::unordered_set<StructType*> escaped_types;
+    fptr_flows flows;
+    // Address-taken functions by type, in module order
+    std::unordered_map<FunctionType*, std::vector<Function*>> signature_targets;
+    mutable size_t layer_resolved = 0;
+    mutable size_t signature_resolved = 0;
+
+    layer_info& getLayer(const field_path_t &path);
+
+    void addStoredValue(const field_path_t &path, Value *val);
+
+    void markEscaped(StructType *T, const struct_filter &type_tracker);
+
+    // Nothing is returned if any compatible path is open or no path is recorded
+    bool collectTargets(const field_path_t &path, targets_t &res, std::set<field_path_t, path_less> &visited) const;
+};
@@ -1,46 +1,197 @@
+#include <unordered_map>
 #include <unordered_set>
+#include <fnmatch.h>
 #include "llvm/Pass.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/IntrinsicInst.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/IR/LegacyPassManager.h"
 #include "llvm/Transforms/IPO/PassManagerBuilder.h"
+#include "llvm/Support/CommandLine.h"
 #include "util.h"
 
 using namespace llvm;
 
-// TODO: read list of structures from a file
-std::unordered_set<std::string> NO_PTR_STORE = {
+static cl::opt<std::string> PurgeRules(
+        "purge-rules",
+        cl::desc("File with structs and fields, that must not receive stored pointers"),
+        cl::init("")
+);
+
+// Used if no rule file is given
+static const std::vector<std::string> DEFAULT_RULES = {
         "struct.list_head",
         "struct.hlist_node",
         "struct.llist_node",
 };
 
+// Rule line is a struct name or a glob, optionally followed by ":<field index>" or ":*"
+//   struct.list_head      pointers to it are never stored
+//   struct.foo:2          no pointer is stored into field 2 of struct.foo
+//   struct.foo:*          no pointer is stored into any field of struct.foo
+// Memcpy, memmove and memset into a region matched by a field rule are removed as well.
+struct purge_rule {
+    std::string text;
+    std::string pattern;
+    std::optional<size_t> field;
+    bool all_fields = false;
+    size_t hits = 0;
+};
+
+// Rules, that match one struct type
+struct type_rules {
+    std::optional<size_t> stored_ptr;
+    std::optional<size_t> all_fields;
+    std::unordered_map<size_t, size_t> fields;
+};
+
 struct StorePurgerPass : public ModulePass {
     StorePurgerPass(): ModulePass(ID) {}
 
     bool runOnModule(Module &M) override {
-        restricted_for_store = findAllStructsByName(M, NO_PTR_STORE);
-        removeAllStores(M);
-        return false;
+        loadRules();
+        compileRules(M);
+        size_t purged = removeAllStores(M);
+        outs() << "Removed " << purged << " stores\n";
+        for (auto &rule : rules) {
+            outs() << "  " << rule.text << ": " << rule.hits << "\n";
+        }
+        outs().flush();
+        rules.clear();
+        matched_types.clear();
+        return purged != 0;
     }
     static char ID;
 private:
-    std::unordered_set<Type*> restricted_for_store;
+    std::vector<purge_rule> rules;
+    // Every struct is matched against rules once
+    DenseMap<StructType*, type_rules> matched_types;
+
+    void loadRules() {
+        auto lines = PurgeRules.empty() ? DEFAULT_RULES : readConfigLines(PurgeRules.getValue());
+        for (auto &line : lines) {
+            purge_rule rule;
+            rule.text = rule.pattern = line;
+            auto [name, field] = StringRef(line).rsplit(':');
+            size_t field_idx;
+            if (field == "*") {
+                rule.pattern = name.str();
+                rule.all_fields = true;
+            } else if (!field.empty() && !field.getAsInteger(10, field_idx)) {
+                rule.pattern = name.str();
+                rule.field = field_idx;
+            }
+            rules.push_back(std::move(rule));
+        }
+    }
+
+    void compileRules(Module &M) {
+        std::unordered_map<std::string, std::vector<size_t>> exact;
+        std::vector<size_t> globs;
+        size_t found_structs = 0;
+        for (size_t i = 0; i < rules.size(); i++) {
+            if (rules[i].pattern.find_first_of("*?[\\") == std::string::npos) {
+                exact[rules[i].pattern].push_back(i);
+            } else {
+                globs.push_back(i);
+            }
+        }
+        for (auto *s : M.getIdentifiedStructTypes()) {
+            auto name = s->getName().str();
+            std::vector<size_t> matched;
+            if (auto it = exact.find(name); it != exact.end()) {
+                matched = it->second;
+            }
+            for (auto i : globs) {
+                if (fnmatch(rules[i].pattern.c_str(), name.c_str(), 0) == 0) {
+                    matched.push_back(i);
+                }
+            }
+            if (matched.empty()) {
+                continue;
+            }
+            auto &type_match = matched_types[s];
+            for (auto i : matched) {
+                if (rules[i].all_fields) {
+                    type_match.all_fields = type_match.all_fields.value_or(i);
+                } else if (!rules[i].field) {
+                    type_match.stored_ptr = type_match.stored_ptr.value_or(i);
+                } else if (*rules[i].field < s->getNumElements()) {
+                    type_match.fields.try_emplace(*rules[i].field, i);
+                }
+            }
+            found_structs++;
+        }
+        outs() << "Structs matched by rules: " << found_structs << "\n";
+    }
+
+    // Rule, that forbids storing a pointer to this type
+    std::optional<size_t> matchStoredValue(Type *t) {
+        auto *type = dereferenceStructPtr(t);
+        if (!type) {
+            return std::nullopt;
+        }
+        auto it = matched_types.find(type);
+        return it == matched_types.end() ? std::nullopt : it->second.stored_ptr;
+    }
+
+    // Rule, that forbids writing into memory pointed by ptr
+    std::optional<size_t> matchDestination(Value *ptr) {
+        for (auto &[type, idx] : getAccessedFieldPath(ptr)) {
+            auto it = matched_types.find(type);
+            if (it == matched_types.end()) {
+                continue;
+            }
+            if (it->second.all_fields) {
+                return it->second.all_fields;
+            }
+            if (auto field = it->second.fields.find(idx); field != it->second.fields.end()) {
+                return field->second;
+            }
+        }
+        // Whole object is overwritten
+        if (auto *type = dereferenceStructPtr(ptr->stripPointerCasts()->getType())) {
+            auto it = matched_types.find(type);
+            if (it != matched_types.end()) {
+                return it->second.all_fields;
+            }
+        }
+        return std::nullopt;
+    }
 
-    void removeAllStores(Module &M) {
+    std::optional<size_t> matchInstruction(Instruction &inst) {
+        if (auto *store = dyn_cast<StoreInst>(&inst)) {
+            // Stack slots(spilled arguments and locals) are not objects
+            if (isa<AllocaInst>(store->getPointerOperand()->stripPointerCasts())) {
+                return std::nullopt;
+            }
+            auto *value_type = store->getValueOperand()->getType();
+            if (auto rule = matchStoredValue(value_type)) {
+                return rule;
+            }
+            if (value_type->isPointerTy()) {
+                return matchDestination(store->getPointerOperand());
+            }
+        } else if (auto *mem = dyn_cast<MemIntrinsic>(&inst)) {
+            return matchDestination(mem->getRawDest());
+        }
+        return std::nullopt;
+    }
+
+    // All rules are applied in a single sweep
+    size_t removeAllStores(Module &M) {
+        if (matched_types.empty()) {
+            return 0;
+        }
         size_t purged = 0;
         for (auto &f : M) {
             for (auto &bb : f) {
                 std::vector<Instruction*> remove_list;
                 for (auto &inst : bb) {
-                    if (auto *store = dyn_cast<StoreInst>(&inst)) {
-                        auto *type = dereferenceStructPtr(store->getValueOperand()->getType());
-                        if (!type || !restricted_for_store.contains(type)) {
-                            continue;
-                        }
+                    if (auto rule = matchInstruction(inst)) {
+                        rules[*rule].hits++;
                         purged++;
-                        remove_list.push_back(store);
-                        //store->eraseFromParent();
+                        remove_list.push_back(&inst);
                     }
                 }
                 for (auto i : remove_list) {
@@ -48,8 +199,7 @@ private:
                 }
             }
         }
-        outs() << "Removed " << purged << " stores\n";
-        outs().flush();
+        return purged;
     }
 };
 
@@ -61,7 +211,7 @@ static RegisterPass<StorePurgerPass> X("remove-store", "Remove unwanted stores",
 
 static RegisterStandardPasses Y(
         PassManagerBuilder::EP_OptimizerLast,
-        [](const PassManagerBuilder &Builder, legacy::PassManagerBase &PM) {
+        [](const PassManagerBuilder &, legacy::PassManagerBase &PM) {
             PM.add(new StorePurgerPass());
         }
 );
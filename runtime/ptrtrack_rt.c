@@ -0,0 +1,158 @@
+// Runtime of -trace-icalls. Every thread deduplicates (call site, target) pairs in its own open addressing table
+// without locks, tables of all threads are merged at exit and written to $PTRTRACK_OUT(ptrtrack.trace by default),
+// one "function#index target" line per pair. Targets are named by dladdr, so link traced programs with -rdynamic.
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <dlfcn.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PTRTRACK_INITIAL_SIZE 1024
+
+struct ptrtrack_entry {
+    // Written last, an entry is valid once its site is set
+    const char *site;
+    void *target;
+};
+
+// Only the owner thread writes to a table, the dump at exit only reads
+struct ptrtrack_table {
+    // All tables ever created, replaced tables are kept: the dump may read them concurrently
+    struct ptrtrack_table *next;
+    size_t size;
+    size_t used;
+    struct ptrtrack_entry entries[];
+};
+
+static struct ptrtrack_table *all_tables;
+static __thread struct ptrtrack_table *thread_table;
+
+static size_t hashPair(const char *site, void *target) {
+    uint64_t hash = (uint64_t)(uintptr_t)site * 0x9e3779b97f4a7c15ULL ^ (uint64_t)(uintptr_t)target;
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+// Return 1 if the pair is already in the table
+static int findPair(const struct ptrtrack_table *table, const char *site, void *target) {
+    size_t mask = table->size - 1;
+    for (size_t pos = hashPair(site, target) & mask;; pos = (pos + 1) & mask) {
+        const struct ptrtrack_entry *entry = &table->entries[pos];
+        const char *entry_site = __atomic_load_n(&entry->site, __ATOMIC_RELAXED);
+        if (!entry_site) {
+            return 0;
+        }
+        if (entry_site == site && entry->target == target) {
+            return 1;
+        }
+    }
+}
+
+// Table must have a free slot
+static void insertPair(struct ptrtrack_table *table, const char *site, void *target) {
+    size_t mask = table->size - 1;
+    size_t pos = hashPair(site, target) & mask;
+    while (__atomic_load_n(&table->entries[pos].site, __ATOMIC_RELAXED)) {
+        pos = (pos + 1) & mask;
+    }
+    table->entries[pos].target = target;
+    __atomic_store_n(&table->entries[pos].site, site, __ATOMIC_RELEASE);
+    table->used++;
+}
+
+// New table gets all pairs of the old one and is published with a lock-free push
+static struct ptrtrack_table *growTable(struct ptrtrack_table *old) {
+    size_t size = old ? 2 * old->size : PTRTRACK_INITIAL_SIZE;
+    struct ptrtrack_table *table = calloc(1, sizeof(*table) + size * sizeof(struct ptrtrack_entry));
+    if (!table) {
+        return NULL;
+    }
+    table->size = size;
+    for (size_t i = 0; old && i < old->size; i++) {
+        if (old->entries[i].site) {
+            insertPair(table, old->entries[i].site, old->entries[i].target);
+        }
+    }
+    table->next = __atomic_load_n(&all_tables, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&all_tables, &table->next, table, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    }
+    return table;
+}
+
+// Called before every traced indirect call, the common path is one hash and a probe of a thread-local table
+void __ptrtrack_icall(const char *site, void *target) {
+    struct ptrtrack_table *table = thread_table;
+    if (table && findPair(table, site, target)) {
+        return;
+    }
+    // Keep the table at most 3/4 full
+    if (!table || 4 * (table->used + 1) > 3 * table->size) {
+        struct ptrtrack_table *grown = growTable(table);
+        if (!grown) {
+            // Out of memory, the pair is lost
+            return;
+        }
+        thread_table = table = grown;
+    }
+    insertPair(table, site, target);
+}
+
+static int comparePairs(const void *a, const void *b) {
+    const struct ptrtrack_entry *x = a, *y = b;
+    int by_site = strcmp(x->site, y->site);
+    if (by_site) {
+        return by_site;
+    }
+    return x->target < y->target ? -1 : x->target > y->target;
+}
+
+__attribute__((destructor))
+static void ptrtrackDump(void) {
+    struct ptrtrack_table *tables = __atomic_load_n(&all_tables, __ATOMIC_ACQUIRE);
+    size_t capacity = 0;
+    for (struct ptrtrack_table *table = tables; table; table = table->next) {
+        capacity += table->size;
+    }
+    struct ptrtrack_entry *pairs = malloc((capacity ? capacity : 1) * sizeof(struct ptrtrack_entry));
+    if (!pairs) {
+        return;
+    }
+    size_t count = 0;
+    for (struct ptrtrack_table *table = tables; table; table = table->next) {
+        for (size_t i = 0; i < table->size; i++) {
+            const char *site = __atomic_load_n(&table->entries[i].site, __ATOMIC_ACQUIRE);
+            if (site) {
+                pairs[count].site = site;
+                pairs[count].target = table->entries[i].target;
+                count++;
+            }
+        }
+    }
+    qsort(pairs, count, sizeof(struct ptrtrack_entry), comparePairs);
+
+    const char *path = getenv("PTRTRACK_OUT");
+    FILE *out = fopen(path ? path : "ptrtrack.trace", "w");
+    if (!out) {
+        perror("ptrtrack: cannot write the trace");
+        free(pairs);
+        return;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (i > 0 && comparePairs(&pairs[i - 1], &pairs[i]) == 0) {
+            continue;
+        }
+        Dl_info info;
+        if (dladdr(pairs[i].target, &info) && info.dli_sname && info.dli_saddr == pairs[i].target) {
+            fprintf(out, "%s %s\n", pairs[i].site, info.dli_sname);
+        } else {
+            fprintf(out, "%s %p\n", pairs[i].site, pairs[i].target);
+        }
+    }
+    fclose(out);
+    free(pairs);
+}
@@ -0,0 +1,96 @@
+#include "sidecar_index.h"
+#include "llvm/Support/EndianStream.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+uint32_t sidecar_index_writer::addString(const std::string &str) {
+    if (str.empty()) {
+        return SIDECAR_NO_STRING;
+    }
+    auto [it, inserted] = string_offsets.try_emplace(str, strings.size());
+    if (inserted) {
+        strings.append(str);
+        strings.push_back('\0');
+    }
+    return it->second;
+}
+
+void sidecar_index_writer::addField(const std::string &type_name, uint32_t field_idx,
+                                    const std::string &singleton, const std::string &stub) {
+    fields.push_back({addString(type_name), field_idx, addString(singleton), addString(stub)});
+}
+
+void sidecar_index_writer::addCall(const std::string &function, uint32_t inst_idx,
+                                   const std::string &type_name, uint32_t field_idx) {
+    calls.push_back({addString(function), inst_idx, addString(type_name), field_idx});
+}
+
+// Build an open addressing table over entries with (name, idx) keys
+template<typename Entry, typename KeyFn>
+static std::vector<uint32_t> buildTable(const std::vector<Entry> &entries, const std::string &strings, KeyFn key) {
+    std::vector<uint32_t> table(sidecarBucketCount(entries.size()), 0);
+    uint32_t mask = table.size() - 1;
+    for (uint32_t i = 0; i < entries.size(); i++) {
+        auto [name, idx] = key(entries[i]);
+        uint32_t pos = sidecarHash(strings.c_str() + name, idx) & mask;
+        while (table[pos] != 0) {
+            pos = (pos + 1) & mask;
+        }
+        table[pos] = i + 1;
+    }
+    return table;
+}
+
+bool sidecar_index_writer::write(const std::string &path, std::string &error) {
+    auto field_table = buildTable(fields, strings, [](const sidecar_field_entry &e) {
+        return std::pair{e.type_name, e.field_idx};
+    });
+    auto call_table = buildTable(calls, strings, [](const sidecar_call_entry &e) {
+        return std::pair{e.function, e.inst_idx};
+    });
+
+    sidecar_header header{};
+    std::memcpy(header.magic, SIDECAR_MAGIC, sizeof(SIDECAR_MAGIC));
+    header.version = SIDECAR_VERSION;
+    header.field_count = fields.size();
+    header.field_buckets = field_table.size();
+    header.call_count = calls.size();
+    header.call_buckets = call_table.size();
+    header.strings_size = strings.size();
+    header.fields_offset = sizeof(sidecar_header);
+    header.field_table_offset = header.fields_offset + fields.size() * sizeof(sidecar_field_entry);
+    header.calls_offset = header.field_table_offset + field_table.size() * sizeof(uint32_t);
+    header.call_table_offset = header.calls_offset + calls.size() * sizeof(sidecar_call_entry);
+    header.strings_offset = header.call_table_offset + call_table.size() * sizeof(uint32_t);
+
+    std::error_code ec;
+    raw_fd_ostream out(path, ec);
+    if (ec) {
+        error = "Cannot write sidecar index " + path + ": " + ec.message();
+        return false;
+    }
+    support::endian::Writer le(out, support::little);
+    out.write(header.magic, sizeof(header.magic));
+    le.write<uint32_t>({header.version, header.field_count, header.field_buckets,
+                        header.call_count, header.call_buckets, header.strings_size});
+    le.write<uint64_t>({header.fields_offset, header.field_table_offset, header.calls_offset,
+                        header.call_table_offset, header.strings_offset});
+    for (auto &e : fields) {
+        le.write<uint32_t>({e.type_name, e.field_idx, e.singleton, e.stub});
+    }
+    le.write<uint32_t>(field_table);
+    for (auto &e : calls) {
+        le.write<uint32_t>({e.function, e.inst_idx, e.type_name, e.field_idx});
+    }
+    le.write<uint32_t>(call_table);
+    out.write(strings.data(), strings.size());
+    out.close();
+    if (out.has_error()) {
+        error = "Cannot write sidecar index " + path + ": " + out.error().message();
+        // Otherwise the stream aborts on destruction
+        out.clear_error();
+        return false;
+    }
+    return true;
+}
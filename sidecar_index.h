@@ -0,0 +1,204 @@
+#pragma once
+// On-disk format of the instrumentation sidecar index.
+// The reader is header-only and LLVM-free, so downstream tools can mmap the file and look entries up directly.
+//
+// Layout (little-endian, fields of every struct are written in order without padding):
+//   sidecar_header
+//   sidecar_field_entry[field_count]
+//   uint32_t[field_buckets]         open addressing table, entry index + 1, 0 is empty
+//   sidecar_call_entry[call_count]
+//   uint32_t[call_buckets]
+//   char[strings_size]              NUL-terminated strings, referenced by offset
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+static constexpr char SIDECAR_MAGIC[8] = {'P', 'T', 'R', 'I', 'D', 'X', 0, 0};
+static constexpr uint32_t SIDECAR_VERSION = 1;
+// Field index of an entry describing the whole type
+static constexpr uint32_t SIDECAR_NO_FIELD = UINT32_MAX;
+// String offset of a missing symbol
+static constexpr uint32_t SIDECAR_NO_STRING = UINT32_MAX;
+
+struct sidecar_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t field_count;
+    uint32_t field_buckets;
+    uint32_t call_count;
+    uint32_t call_buckets;
+    uint32_t strings_size;
+    uint64_t fields_offset;
+    uint64_t field_table_offset;
+    uint64_t calls_offset;
+    uint64_t call_table_offset;
+    uint64_t strings_offset;
+};
+static_assert(sizeof(sidecar_header) == 72, "sidecar_header must have no padding");
+
+// (struct type, field index) -> singleton and stub symbols
+struct sidecar_field_entry {
+    uint32_t type_name;
+    uint32_t field_idx;
+    uint32_t singleton;
+    uint32_t stub;
+};
+
+// (function, instruction index in the input body) of an indirect call -> loaded struct field
+struct sidecar_call_entry {
+    uint32_t function;
+    uint32_t inst_idx;
+    uint32_t type_name;
+    uint32_t field_idx;
+};
+
+// FNV-1a over the name bytes and the index
+inline uint64_t sidecarHash(std::string_view name, uint32_t idx) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : name) {
+        hash = (hash ^ c) * 1099511628211ULL;
+    }
+    for (int i = 0; i < 4; i++) {
+        hash = (hash ^ ((idx >> (8 * i)) & 0xff)) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Smallest power of two, that keeps the table at most half full
+inline uint32_t sidecarBucketCount(uint32_t entries) {
+    uint32_t buckets = 1;
+    while (buckets < 2 * entries) {
+        buckets <<= 1;
+    }
+    return buckets;
+}
+
+// Values are little-endian in the file and decoded byte by byte, so the reader works on any host
+inline uint32_t sidecarRead32(const char *p) {
+    auto *bytes = reinterpret_cast<const unsigned char*>(p);
+    return uint32_t(bytes[0]) | uint32_t(bytes[1]) << 8 | uint32_t(bytes[2]) << 16 | uint32_t(bytes[3]) << 24;
+}
+
+inline uint64_t sidecarRead64(const char *p) {
+    return uint64_t(sidecarRead32(p)) | uint64_t(sidecarRead32(p + 4)) << 32;
+}
+
+class sidecar_index_reader {
+public:
+    // data must stay mapped while the reader is used
+    sidecar_index_reader(const void *data, size_t size): data(static_cast<const char*>(data)), size(size) {
+        if (size < sizeof(sidecar_header) || std::memcmp(data, SIDECAR_MAGIC, sizeof(SIDECAR_MAGIC)) != 0) {
+            return;
+        }
+        const char *p = this->data + sizeof(SIDECAR_MAGIC);
+        for (uint32_t *field : {&header.version, &header.field_count, &header.field_buckets,
+                                &header.call_count, &header.call_buckets, &header.strings_size}) {
+            *field = sidecarRead32(p);
+            p += sizeof(uint32_t);
+        }
+        for (uint64_t *field : {&header.fields_offset, &header.field_table_offset, &header.calls_offset,
+                                &header.call_table_offset, &header.strings_offset}) {
+            *field = sidecarRead64(p);
+            p += sizeof(uint64_t);
+        }
+        // Probing stops at an empty bucket, so a table must have more buckets than entries
+        valid = header.version == SIDECAR_VERSION &&
+                validTable(header.field_count, header.field_buckets) &&
+                validTable(header.call_count, header.call_buckets) &&
+                inBounds(header.fields_offset, uint64_t(header.field_count) * sizeof(sidecar_field_entry)) &&
+                inBounds(header.field_table_offset, uint64_t(header.field_buckets) * sizeof(uint32_t)) &&
+                inBounds(header.calls_offset, uint64_t(header.call_count) * sizeof(sidecar_call_entry)) &&
+                inBounds(header.call_table_offset, uint64_t(header.call_buckets) * sizeof(uint32_t)) &&
+                inBounds(header.strings_offset, header.strings_size) &&
+                (header.strings_size == 0 || this->data[header.strings_offset + header.strings_size - 1] == '\0');
+    }
+
+    [[nodiscard]] bool isValid() const {
+        return valid;
+    }
+
+    [[nodiscard]] const char* string(uint32_t offset) const {
+        if (!valid || offset == SIDECAR_NO_STRING || offset >= header.strings_size) {
+            return nullptr;
+        }
+        return data + header.strings_offset + offset;
+    }
+
+    // Pass SIDECAR_NO_FIELD to get the singleton of the type
+    [[nodiscard]] std::optional<sidecar_field_entry> findField(std::string_view type_name, uint32_t field_idx) const {
+        if (!valid) {
+            return std::nullopt;
+        }
+        return lookup<sidecar_field_entry>(header.fields_offset, header.field_count, header.field_table_offset,
+                                           header.field_buckets, type_name, field_idx);
+    }
+
+    [[nodiscard]] std::optional<sidecar_call_entry> findCall(std::string_view function, uint32_t inst_idx) const {
+        if (!valid) {
+            return std::nullopt;
+        }
+        return lookup<sidecar_call_entry>(header.calls_offset, header.call_count, header.call_table_offset,
+                                          header.call_buckets, function, inst_idx);
+    }
+
+private:
+    const char *data;
+    size_t size;
+    sidecar_header header{};
+    bool valid = false;
+
+    [[nodiscard]] bool inBounds(uint64_t offset, uint64_t len) const {
+        return offset <= size && len <= size - offset;
+    }
+
+    [[nodiscard]] static bool validTable(uint32_t entries, uint32_t buckets) {
+        return buckets != 0 && (buckets & (buckets - 1)) == 0 && buckets > entries;
+    }
+
+    // Both entry types are four uint32_t, the first two are the key
+    template<typename Entry>
+    std::optional<Entry> lookup(uint64_t entries_offset, uint32_t count, uint64_t table_offset, uint32_t buckets,
+                                std::string_view name, uint32_t idx) const {
+        static_assert(sizeof(Entry) == 4 * sizeof(uint32_t));
+        uint32_t mask = buckets - 1;
+        uint32_t pos = sidecarHash(name, idx) & mask;
+        for (uint32_t probes = 0; probes < buckets; probes++, pos = (pos + 1) & mask) {
+            uint32_t slot = sidecarRead32(data + table_offset + pos * sizeof(uint32_t));
+            if (slot == 0 || slot > count) {
+                return std::nullopt;
+            }
+            const char *p = data + entries_offset + (slot - 1) * sizeof(Entry);
+            Entry entry{sidecarRead32(p), sidecarRead32(p + 4), sidecarRead32(p + 8), sidecarRead32(p + 12)};
+            auto *str = string(sidecarRead32(p));
+            if (sidecarRead32(p + 4) == idx && str && name == str) {
+                return entry;
+            }
+        }
+        return std::nullopt;
+    }
+};
+
+// Collects entries and serializes them into the format above
+class sidecar_index_writer {
+public:
+    void addField(const std::string &type_name, uint32_t field_idx,
+                  const std::string &singleton, const std::string &stub);
+
+    void addCall(const std::string &function, uint32_t inst_idx, const std::string &type_name, uint32_t field_idx);
+
+    // Return false and set the error if the file cannot be written
+    bool write(const std::string &path, std::string &error);
+private:
+    std::vector<sidecar_field_entry> fields;
+    std::vector<sidecar_call_entry> calls;
+    std::string strings;
+    std::unordered_map<std::string, uint32_t> string_offsets;
+
+    uint32_t addString(const std::string &str);
+};
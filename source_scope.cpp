@@ -0,0 +1,36 @@
+#include <fnmatch.h>
+#include "source_scope.h"
+#include "util.h"
+
+source_scope::source_scope(std::vector<std::string> include, std::vector<std::string> exclude):
+        include(std::move(include)), exclude(std::move(exclude)) {}
+
+bool source_scope::isGlobal() const {
+    return include.empty() && exclude.empty();
+}
+
+bool source_scope::matchesAny(const std::string &path, const std::vector<std::string> &patterns) {
+    return std::ranges::any_of(patterns, [&path](const std::string &pattern) {
+        if (pattern.find_first_of("*?[") != std::string::npos) {
+            return fnmatch(pattern.c_str(), path.c_str(), 0) == 0;
+        }
+        return path.find(pattern) != std::string::npos;
+    });
+}
+
+bool source_scope::contains(const GlobalValue *v) {
+    if (isGlobal()) {
+        return true;
+    }
+    if (auto it = cache.find(v); it != cache.end()) {
+        return it->second;
+    }
+    bool in_scope;
+    if (auto path = getSourcePath(v)) {
+        in_scope = (include.empty() || matchesAny(*path, include)) && !matchesAny(*path, exclude);
+    } else {
+        in_scope = include.empty();
+    }
+    cache[v] = in_scope;
+    return in_scope;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/IR/IRBuilder.h"
+
+using namespace llvm;
+
+// Restricts instrumentation to a part of the module by source paths from debug info.
+// Pattern matches any path, that contains it(e.g. "fs/ext4/"), or a glob over the whole path.
+// With include patterns only matching code is in scope, code without debug info is out of scope.
+// Exclude patterns always win.
+class source_scope {
+public:
+    source_scope() = default;
+
+    source_scope(std::vector<std::string> include, std::vector<std::string> exclude);
+
+    // True if no patterns are given
+    [[nodiscard]] bool isGlobal() const;
+
+    // Check a function or a global variable
+    bool contains(const GlobalValue *v);
+private:
+    std::vector<std::string> include;
+    std::vector<std::string> exclude;
+    DenseMap<const GlobalValue*, bool> cache;
+
+    static bool matchesAny(const std::string &path, const std::vector<std::string> &patterns);
+};
@@ -1,9 +1,26 @@
+#include <algorithm>
+#include <queue>
 #include "struct_filter.h"
 #include "util.h"
 
-struct_filter::struct_filter(Module *M): M(M) {
+struct_filter::struct_filter(Module *M, const type_policy *policy, const unloaded_body_types *unloaded):
+        M(M), policy(policy), unloaded(unloaded) {
+    all_types = M->getIdentifiedStructTypes();
+    if (unloaded) {
+        std::unordered_set<StructType*> found(all_types.begin(), all_types.end());
+        std::set<StructType*, struct_name_less> missing;
+        for (auto *s : unloaded->identified) {
+            if (!found.contains(s)) {
+                missing.insert(s);
+            }
+        }
+        all_types.insert(all_types.end(), missing.begin(), missing.end());
+    }
     buildTypeGraph();
     findInterestingStructs();
+    findEmbeddingOrder();
+    this->policy = nullptr;
+    this->unloaded = nullptr;
 }
 
 bool struct_filter::isInterestingType(Type *t) {
@@ -28,13 +45,21 @@ void struct_filter::findInterestingStructs() {
     // used_struct may contain nullptr
     std::unordered_set<StructType*> used_structs, interesting;
 
-    for (auto s : M->getIdentifiedStructTypes()) {
-        for (auto field : s->elements()) {
-            if (isFunctionPointer(field)) {
-                // This struct contains a pointer to a function
-                markParentsUsed(s, interesting);
-                break;
-            }
+    std::vector<StructType*> fptr_structs;
+    for (auto s : all_types) {
+        if (denied_types.contains(s)) {
+            continue;
+        }
+        if (std::ranges::any_of(s->elements(), isFunctionPointer)) {
+            // This struct contains a pointer to a function
+            fptr_structs.push_back(s);
+        }
+    }
+    if (auto max_depth = policy ? policy->getMaxDepth() : std::nullopt) {
+        markParentsUpToDepth(fptr_structs, *max_depth, interesting);
+    } else {
+        for (auto *s : fptr_structs) {
+            markParentsUsed(s, interesting);
         }
     }
     // Now we have all interesting structs
@@ -42,6 +67,13 @@ void struct_filter::findInterestingStructs() {
     // Globals should be marked used with all field
     // T { G } may have G defined but never accessed from any function
     // in this case T is passed to an external function, which will access G
+    // Every initialized struct is marked, even if it is deeply nested or shared between globals
+    constant_walker used_marker([&used_structs](Constant *c) {
+        if (auto *init_struct = dyn_cast<ConstantStruct>(c)) {
+            used_structs.insert(init_struct->getType());
+        }
+        return c;
+    });
     for (auto &glob : M->getGlobalList()) {
         if (!glob.hasInitializer() || glob.isNullValue()) {
             continue;
@@ -50,27 +82,7 @@ void struct_filter::findInterestingStructs() {
         if (!initializer || initializer->isZeroValue() || initializer->isNullValue()) {
             continue;
         }
-        if (dyn_cast<StructType>(glob.getValueType())) {
-            auto *init_struct = dyn_cast<ConstantStruct>(initializer);
-            if (!init_struct) {
-                continue;
-            }
-            markUsedGlobalRecursively(init_struct, used_structs);
-        } else if (auto *arr_ty = dyn_cast<ArrayType>(glob.getValueType())) {
-            auto *init_arr = dyn_cast<ConstantArray>(glob.getInitializer());
-            auto *el_ty = dyn_cast<StructType>(arr_ty->getElementType());
-            if (!init_arr || !el_ty) {
-                continue;
-            }
-            for (size_t i = 0; i < initializer->getNumOperands(); i++) {
-                auto *el = dyn_cast<ConstantStruct>(initializer->getOperand(i));
-                if (!el) {
-                    // It is a zero initializer(usually as a marker of array end)
-                    continue;
-                }
-                markUsedGlobalRecursively(el, used_structs);
-            }
-        }
+        used_marker.walk(initializer);
     }
     // Get function arguments
     for (auto &f : M->getFunctionList()) {
@@ -82,23 +94,10 @@ void struct_filter::findInterestingStructs() {
     }
     // Get all used types, used in instructions
     for (auto &f : *M) {
-        for (auto &bb : f) {
-            for (auto &inst : bb) {
-                if (auto *cast = dyn_cast<BitCastInst>(&inst)) {
-                    used_structs.insert(getStructType(cast->getSrcTy()));
-                    used_structs.insert(getStructType(cast->getDestTy()));
-                } else if (auto *gep = dyn_cast<GetElementPtrInst>(&inst)) {
-                    used_structs.insert(getStructType(gep->getSourceElementType()));
-                    used_structs.insert(getStructType(gep->getResultElementType()));
-                } else if (auto *i2p = dyn_cast<IntToPtrInst>(&inst)) {
-                    used_structs.insert(getStructType(i2p->getDestTy()));
-                } else if (auto *load = dyn_cast<LoadInst>(&inst)) {
-                    used_structs.insert(getStructType(load->getPointerOperandType()));
-                } else if (auto *store = dyn_cast<StoreInst>(&inst)) {
-                    used_structs.insert(getStructType(store->getPointerOperandType()));
-                }
-            }
-        }
+        collectUsedStructs(f, used_structs);
+    }
+    if (unloaded) {
+        used_structs.insert(unloaded->used.begin(), unloaded->used.end());
     }
     for (auto *i_s : interesting) {
         if (used_structs.contains(i_s)) {
@@ -111,27 +110,80 @@ void struct_filter::findInterestingStructs() {
     //outs().flush();
 }
 
-void struct_filter::markUsedGlobalRecursively(ConstantStruct *val, std::unordered_set<StructType*> &used) {
-    auto *t = val->getType();
-    // TODO: if there are two globals with the same type, but different initialized fields, one will be skipped
-    if (used.contains(t)) {
-        return;
+void struct_filter::collectUsedStructs(Function &f, std::unordered_set<StructType*> &used) {
+    for (auto &bb : f) {
+        for (auto &inst : bb) {
+            if (auto *cast = dyn_cast<BitCastInst>(&inst)) {
+                used.insert(getStructType(cast->getSrcTy()));
+                used.insert(getStructType(cast->getDestTy()));
+            } else if (auto *gep = dyn_cast<GetElementPtrInst>(&inst)) {
+                used.insert(getStructType(gep->getSourceElementType()));
+                used.insert(getStructType(gep->getResultElementType()));
+            } else if (auto *i2p = dyn_cast<IntToPtrInst>(&inst)) {
+                used.insert(getStructType(i2p->getDestTy()));
+            } else if (auto *load = dyn_cast<LoadInst>(&inst)) {
+                used.insert(getStructType(load->getPointerOperandType()));
+            } else if (auto *store = dyn_cast<StoreInst>(&inst)) {
+                used.insert(getStructType(store->getPointerOperandType()));
+            }
+        }
     }
-    used.insert(t);
-    for (size_t i = 0; i < val->getNumOperands(); i++) {
-        if (getStructType(t->getTypeAtIndex(i))) {
-            auto *field_init = dyn_cast<ConstantStruct>(val->getOperand(i));
-            if (field_init && !field_init->isNullValue()) {
-                markUsedGlobalRecursively(field_init, used);
+}
+
+void struct_filter::collectIdentifiedStructs(Function &f, std::unordered_set<StructType*> &identified) {
+    std::unordered_set<Type*> visited;
+    std::vector<Type*> todo;
+    auto addType = [&](Type *t) {
+        if (visited.insert(t).second) {
+            todo.push_back(t);
+        }
+    };
+    addType(f.getFunctionType());
+    for (auto &bb : f) {
+        for (auto &inst : bb) {
+            addType(inst.getType());
+            for (auto &op : inst.operands()) {
+                addType(op->getType());
+            }
+            if (auto *gep = dyn_cast<GetElementPtrInst>(&inst)) {
+                addType(gep->getSourceElementType());
+            } else if (auto *alloca = dyn_cast<AllocaInst>(&inst)) {
+                addType(alloca->getAllocatedType());
+            } else if (auto *call = dyn_cast<CallBase>(&inst)) {
+                addType(call->getFunctionType());
             }
         }
     }
+    while (!todo.empty()) {
+        auto *t = todo.back();
+        todo.pop_back();
+        if (auto *st = dyn_cast<StructType>(t); st && !st->isLiteral() && !identified.insert(st).second) {
+            continue;
+        }
+        if (auto *ptr = dyn_cast<PointerType>(t); ptr && !ptr->isOpaque()) {
+            addType(ptr->getNonOpaquePointerElementType());
+        }
+        for (auto *sub : t->subtypes()) {
+            addType(sub);
+        }
+    }
 }
 
 void struct_filter::buildTypeGraph() {
-    for (auto s : M->getIdentifiedStructTypes()) {
+    if (policy) {
+        for (auto s : all_types) {
+            if (!policy->isAllowed(s, M->getDataLayout())) {
+                denied_types.insert(s);
+            }
+        }
+    }
+    for (auto s : all_types) {
+        if (denied_types.contains(s)) {
+            continue;
+        }
         for (auto field : s->elements()) {
-            if (auto *field_type = getStructType(field)) {
+            auto *field_type = getStructType(field);
+            if (field_type && !denied_types.contains(field_type)) {
                 type_graph[s].insert(field_type);
                 inv_type_graph[field_type].insert(s);
             }
@@ -139,6 +191,47 @@ void struct_filter::buildTypeGraph() {
     }
 }
 
+// Iterative post-order DFS over embedded interesting structs, a struct cannot embed itself,
+// so the post-order is a topological order. Roots and children are visited by name to keep the order stable
+void struct_filter::findEmbeddingOrder() {
+    std::unordered_set<StructType*> visited;
+    // Type and its embedded types left to visit, the next one is at the back
+    std::vector<std::pair<StructType*, std::vector<StructType*>>> frames;
+
+    auto visit = [&](StructType *t) {
+        visited.insert(t);
+        std::vector<StructType*> embedded;
+        for (auto *field : t->elements()) {
+            auto *field_struct = dyn_cast<StructType>(field);
+            if (field_struct && interesting_types.contains(field_struct)) {
+                embedded.push_back(field_struct);
+            }
+        }
+        std::sort(embedded.rbegin(), embedded.rend(), struct_name_less());
+        frames.emplace_back(t, std::move(embedded));
+    };
+
+    for (auto *root : interesting_types) {
+        if (visited.contains(root)) {
+            continue;
+        }
+        visit(root);
+        while (!frames.empty()) {
+            auto &[t, embedded] = frames.back();
+            if (!embedded.empty()) {
+                auto *child = embedded.back();
+                embedded.pop_back();
+                if (!visited.contains(child)) {
+                    visit(child);
+                }
+                continue;
+            }
+            embedding_order.push_back(t);
+            frames.pop_back();
+        }
+    }
+}
+
 void struct_filter::markChildrenUsed(StructType *t, std::unordered_set<StructType*> &dfs_used) {
     if (dfs_used.contains(t)) {
         return;
@@ -159,6 +252,39 @@ void struct_filter::markParentsUsed(StructType *t, std::unordered_set<StructType
     }
 }
 
-const std::set<StructType *> &struct_filter::getInterestingTypes() const {
+// Multi-source BFS: type is marked if it is at most max_depth edges above a root
+void struct_filter::markParentsUpToDepth(const std::vector<StructType*> &roots, size_t max_depth,
+                                         std::unordered_set<StructType*> &used) {
+    std::queue<std::pair<StructType*, size_t>> todo;
+    for (auto *root : roots) {
+        if (used.insert(root).second) {
+            todo.emplace(root, 0);
+        }
+    }
+    while (!todo.empty()) {
+        auto [t, depth] = todo.front();
+        todo.pop();
+        if (depth == max_depth) {
+            continue;
+        }
+        for (auto parent : inv_type_graph[t]) {
+            if (used.insert(parent).second) {
+                todo.emplace(parent, depth + 1);
+            }
+        }
+    }
+}
+
+const std::set<StructType*, struct_name_less> &struct_filter::getInterestingTypes() const {
     return interesting_types;
 }
+
+const std::unordered_set<StructType*> &struct_filter::getChildren(StructType *T) const {
+    static const std::unordered_set<StructType*> empty;
+    auto it = type_graph.find(T);
+    return it == type_graph.end() ? empty : it->second;
+}
+
+const std::vector<StructType*> &struct_filter::getEmbeddingOrder() const {
+    return embedding_order;
+}
@@ -3,14 +3,33 @@
 #include <set>
 #include <unordered_set>
 #include "llvm/IR/IRBuilder.h"
+#include "util.h"
+#include "type_policy.h"
 
 using namespace llvm;
 
+// Types met in function bodies, that were scanned and deleted before the filter is built
+struct unloaded_body_types {
+    // Identified structs, TypeFinder cannot find them anymore
+    std::unordered_set<StructType*> identified;
+    // Structs used by instructions
+    std::unordered_set<StructType*> used;
+};
+
 class struct_filter {
 public:
     struct_filter() = default;
 
-    explicit struct_filter(Module *M);
+    // Policy and unloaded types are used only during construction
+    explicit struct_filter(Module *M, const type_policy *policy = nullptr,
+                           const unloaded_body_types *unloaded = nullptr);
+
+    // Collect structs, that are used by instructions of the function
+    static void collectUsedStructs(Function &f, std::unordered_set<StructType*> &used);
+
+    // Collect identified structs, that types of the function and its instructions refer to.
+    // Structs already in the set are not walked again, so the set can be grown function by function
+    static void collectIdentifiedStructs(Function &f, std::unordered_set<StructType*> &identified);
 
     bool isInterestingType(Type *t);
 
@@ -19,21 +38,39 @@ public:
     // Check is this is an interesting type or a pointer to an interesting type
     bool isInterestingTypeOrPtr(Type *t);
 
-    [[nodiscard]] const std::set<StructType*>& getInterestingTypes() const;
+    // Interesting types ordered by name
+    [[nodiscard]] const std::set<StructType*, struct_name_less>& getInterestingTypes() const;
+
+    // Structs embedded into T or pointed by its fields
+    [[nodiscard]] const std::unordered_set<StructType*>& getChildren(StructType *T) const;
+
+    // Interesting types, every type comes after all interesting types it embeds(inner types first).
+    // Pointers are not followed, so the order exists for any type graph
+    [[nodiscard]] const std::vector<StructType*>& getEmbeddingOrder() const;
 private:
     Module *M = nullptr;
+    const type_policy *policy = nullptr;
+    const unloaded_body_types *unloaded = nullptr;
+    // Identified structs of the module and of unloaded bodies
+    std::vector<StructType*> all_types;
+    // Types rejected by the policy, they are excluded from the type graph
+    std::unordered_set<StructType*> denied_types;
     /// T { G, *F } leads to T -> G and T -> F edges.
     std::unordered_map<StructType*, std::unordered_set<StructType*>> type_graph;
     std::unordered_map<StructType*, std::unordered_set<StructType*>> inv_type_graph;
-    std::set<StructType*> interesting_types;
+    std::set<StructType*, struct_name_less> interesting_types;
+    std::vector<StructType*> embedding_order;
 
     void findInterestingStructs();
 
     void buildTypeGraph();
 
+    void findEmbeddingOrder();
+
     void markChildrenUsed(StructType *t, std::unordered_set<StructType*> &dfs_used);
 
     void markParentsUsed(StructType *t, std::unordered_set<StructType*> &dfs_used);
 
-    void markUsedGlobalRecursively(ConstantStruct *val, std::unordered_set<StructType*> &used);
+    void markParentsUpToDepth(const std::vector<StructType*> &roots, size_t max_depth,
+                              std::unordered_set<StructType*> &used);
 };
@@ -0,0 +1,33 @@
+/*
+ * Test that several interesting types with nested fields are emitted in a stable order
+ */
+struct zeta {
+	void (*f)();
+};
+
+struct alpha {
+	void (*f)();
+	struct zeta z;
+};
+
+struct mid {
+	struct alpha a;
+	struct zeta *zp;
+	void (*g)(int);
+};
+
+void f1();
+void g1(int);
+
+void fill_mid(struct mid *m) {
+	m->a.f = f1;
+	m->a.z.f = f1;
+	m->g = g1;
+}
+
+void call_mid(struct mid *m) {
+    // Expect f1
+	m->zp->f();
+    // Expect g1
+	m->g(0);
+}
@@ -0,0 +1,36 @@
+/*
+ * Test that a field, whose address is passed to an external function, keeps the indirect call in its stub
+ */
+
+struct ops {
+	int dummy;
+	int (*op)(int);
+};
+
+struct closed_ops {
+	int dummy;
+	int (*op)(int);
+};
+
+int twice(int x) { return 2 * x; }
+int square(int x) { return x * x; }
+
+// May store any function into the slot
+void ext_register(int (**slot)(int));
+
+struct ops obj = {0, twice};
+struct closed_ops closed = {0, square};
+
+void setup(void) {
+	ext_register(&obj.op);
+}
+
+int run(struct ops *o, int x) {
+	// Expect the indirect fallback: external code writes this field
+	return o->op(x);
+}
+
+int run_closed(struct closed_ops *o, int x) {
+	// Expect only square
+	return o->op(x);
+}
@@ -0,0 +1,16 @@
+struct ops {
+    int (*op)(int);
+};
+
+double ext_scale(struct ops *o);
+float ext_ratio(struct ops *o);
+
+int twice(int x) {
+    return 2 * x;
+}
+
+struct ops obj = {twice};
+
+double use(void) {
+    return ext_scale(&obj) + ext_ratio(&obj);
+}
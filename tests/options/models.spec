@@ -0,0 +1 @@
+ext_scale keep arg0
@@ -0,0 +1,33 @@
+/*
+ * Test pass options on one program: field based resolution, devirtualized stubs, indexes, budget and dry run
+ */
+
+struct ops {
+	int (*op)(int);
+	int dummy;
+};
+
+struct other {
+	int (*op)(int);
+};
+
+int twice(int x) { return 2 * x; }
+int square(int x) { return x * x; }
+int negate(int x) { return -x; }
+
+struct ops table[] = {{twice, 0}, {square, 0}};
+struct other other_ops = {negate};
+
+int apply(struct ops *o, int x) {
+	// Expect square and twice here, negate has the same signature, but it is never stored into struct ops
+	return o->op(x);
+}
+
+int apply_other(struct other *o, int x) {
+	// Expect negate here
+	return o->op(x);
+}
+
+int main() {
+	return apply(&table[0], 1) + apply_other(&other_ops, 2);
+}
@@ -0,0 +1,20 @@
+# Send requests to the instrumentation server one by one and print the replies
+# usage: server_client.py <socket path> <request>...
+import socket
+import sys
+import time
+
+for _ in range(100):
+    try:
+        sock = socket.socket(socket.AF_UNIX)
+        sock.connect(sys.argv[1])
+        break
+    except OSError:
+        time.sleep(0.1)
+else:
+    sys.exit("Cannot connect to " + sys.argv[1])
+stream = sock.makefile("rw")
+for request in sys.argv[2:]:
+    stream.write(request + "\n")
+    stream.flush()
+    print(stream.readline().strip())
@@ -0,0 +1,49 @@
+/*
+ * Test which bodies are summarized: only functions, that never touch interesting types or function pointers,
+ * keep no pointers and call only summarized functions
+ */
+
+struct ops {
+	int (*op)(int);
+};
+
+int twice(int x) { return 2 * x; }
+
+struct ops table = {twice};
+
+// Expect summarized: only arithmetic and a summarized callee
+int sum(int n) {
+	int s = 0;
+	for (int i = 0; i < n; i++) {
+		s += twice(i);
+	}
+	return s;
+}
+
+// Expect summarized: no pointer is stored
+int bump(int x) {
+	static int counter;
+	counter += x;
+	return counter;
+}
+
+// Expect kept: returns a pointer
+int *leak(int x) {
+	static int value;
+	value = x;
+	return &value;
+}
+
+// Expect kept: calls a kept function
+int read_leaked(int x) {
+	return *leak(x);
+}
+
+// Expect kept: loads a function pointer
+int call_op(int x) {
+	return table.op(x);
+}
+
+int main() {
+	return sum(3) + bump(1) + read_leaked(2) + call_op(4);
+}
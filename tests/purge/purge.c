@@ -0,0 +1,27 @@
+#include <string.h>
+
+struct list_head {
+    struct list_head *next, *prev;
+};
+
+struct foo {
+    int id;
+    struct list_head link;
+    void *data;
+    void (*cb)(void);
+};
+
+struct bar_x {
+    void *p;
+};
+
+void fill(struct foo *f, void *data) {
+    f->link.next = &f->link;
+    f->data = data;
+    f->id = 1;
+    memset(&f->link, 0, sizeof(f->link));
+}
+
+void set_bar(struct bar_x *b, void *p) {
+    b->p = p;
+}
@@ -0,0 +1,80 @@
+// Writes a sidecar index, reads it back and checks lookups and rejection of damaged files
+// usage: sidecar_index_test <scratch file>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include "../sidecar_index.h"
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+    if (!ok) {
+        std::printf("sidecar index test failed: %s\n", what);
+        failures++;
+    }
+}
+
+static bool sameString(const char *str, const char *expected) {
+    return str && std::strcmp(str, expected) == 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        std::printf("usage: %s <scratch file>\n", argv[0]);
+        return 1;
+    }
+    sidecar_index_writer writer;
+    writer.addField("struct.ops", SIDECAR_NO_FIELD, "mypass_struct.ops_singleton", "");
+    writer.addField("struct.ops", 0, "mypass_struct.ops_singleton", "mypass_struct.ops_0_stub");
+    for (uint32_t i = 0; i < 100; i++) {
+        writer.addCall("run", i, "struct.ops", i % 3);
+    }
+    if (std::string error; !writer.write(argv[1], error)) {
+        std::printf("%s\n", error.c_str());
+        return 1;
+    }
+    std::ifstream in(argv[1], std::ios::binary);
+    std::string file(std::istreambuf_iterator<char>(in), {});
+
+    sidecar_index_reader reader(file.data(), file.size());
+    check(reader.isValid(), "written index is invalid");
+    // Header starts with the magic, the version follows as a little-endian uint32_t
+    check(file.size() > 12 && file.compare(8, 4, std::string("\1\0\0\0", 4)) == 0, "version is not little-endian");
+
+    auto type = reader.findField("struct.ops", SIDECAR_NO_FIELD);
+    check(type && sameString(reader.string(type->singleton), "mypass_struct.ops_singleton") &&
+          !reader.string(type->stub), "type entry");
+    auto field = reader.findField("struct.ops", 0);
+    check(field && sameString(reader.string(field->stub), "mypass_struct.ops_0_stub"), "field entry");
+    check(!reader.findField("struct.ops", 1) && !reader.findField("struct.other", 0), "missing field found");
+    bool calls_ok = true;
+    for (uint32_t i = 0; i < 100; i++) {
+        auto call = reader.findCall("run", i);
+        calls_ok &= call && call->field_idx == i % 3 && sameString(reader.string(call->type_name), "struct.ops");
+    }
+    check(calls_ok, "call entries");
+    check(!reader.findCall("run", 100) && !reader.findCall("other", 0), "missing call found");
+
+    // Damaged files are rejected and lookups return nothing
+    for (size_t size : {size_t(0), size_t(7), sizeof(sidecar_header) - 1, file.size() - 1}) {
+        sidecar_index_reader truncated(file.data(), size);
+        check(!truncated.isValid() && !truncated.findField("struct.ops", 0) &&
+              !truncated.findCall("run", 0) && !truncated.string(0), "truncated index is accepted");
+    }
+    // field_buckets follows version and field_count
+    for (uint32_t buckets : {0u, 3u, 2u}) {
+        std::string damaged = file;
+        for (int i = 0; i < 4; i++) {
+            damaged[16 + i] = char((buckets >> (8 * i)) & 0xff);
+        }
+        sidecar_index_reader reader_damaged(damaged.data(), damaged.size());
+        check(!reader_damaged.isValid() && !reader_damaged.findField("struct.ops", 0), "bad bucket count is accepted");
+    }
+    // Write errors are reported instead of aborting
+    std::string error;
+    check(!writer.write("/dev/full", error) && !error.empty(), "failed write is not reported");
+    if (failures == 0) {
+        std::printf("sidecar index test passed\n");
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -1,9 +1,13 @@
 C_SRC="./c-src"
 IR_PATH="./ir"
 RESULT="./ir-final"
+TRACE_SRC="./trace"
+PURGE_SRC="./purge"
+OPTIONS_SRC="./options"
 
 mkdir "$IR_PATH" "$RESULT"
 PASS_PATH="$1"
+STATUS=0
 for file in "$C_SRC"/*.c; do
     FILE_NAME="$(basename "$file" .c)"
     clang-14 -S -emit-llvm -o "$IR_PATH/$FILE_NAME.ll" "$file"
@@ -14,4 +18,158 @@ for file in "$IR_PATH"/*.ll; do
     opt-14 -enable-new-pm=0 -load="$PASS_PATH/ir_instr.so" -instr -impl-extern=false -S -o "$RESULT/$FILE_NAME" "$RESULT/$FILE_NAME"
     echo
 done
-
+# Instrumented bitcode must be byte-identical across runs
+# The second run moves large allocations to mmap, so any order of heap addresses differs between the runs
+for file in "$IR_PATH"/*.ll; do
+    FILE_NAME="$(basename "$file" .ll)"
+    opt-14 -enable-new-pm=0 -load="$PASS_PATH/ir_instr.so" -instr -o "$RESULT/$FILE_NAME.1.bc" "$file" > /dev/null
+    GLIBC_TUNABLES=glibc.malloc.mmap_threshold=4096:glibc.malloc.perturb=165 \
+        opt-14 -enable-new-pm=0 -load="$PASS_PATH/ir_instr.so" -instr -o "$RESULT/$FILE_NAME.2.bc" "$file" > /dev/null
+    if ! cmp -s "$RESULT/$FILE_NAME.1.bc" "$RESULT/$FILE_NAME.2.bc"; then
+        echo "Non-reproducible output for $FILE_NAME"
+        STATUS=1
+    fi
+done
+# Hits of every purge rule, with the default rules and with a rule file
+clang-14 -S -emit-llvm -o "$RESULT/purge.ll" "$PURGE_SRC/purge.c"
+for rules in default rules; do
+    RULE_ARG=""
+    if [ "$rules" != default ]; then
+        RULE_ARG="-purge-rules=$PURGE_SRC/$rules.txt"
+    fi
+    opt-14 -enable-new-pm=0 -load="$PASS_PATH/purge_stores.so" -remove-store $RULE_ARG -disable-output \
+        "$RESULT/purge.ll" | grep '^  ' > "$RESULT/purge.$rules.hits"
+    if ! cmp -s "$RESULT/purge.$rules.hits" "$PURGE_SRC/$rules.expected"; then
+        echo "Unexpected purge hits with $rules rules"
+        STATUS=1
+    fi
+done
+# Options of the pass on small programs, outputs are compared with the expected ones
+OPT="opt-14 -enable-new-pm=0 -load=$PASS_PATH/ir_instr.so"
+compile_options_test() {
+    clang-14 -g -c -emit-llvm -o "$RESULT/$1.bc" "$OPTIONS_SRC/$1.c"
+}
+check_output() {
+    if ! cmp -s "$1" "$OPTIONS_SRC/$2"; then
+        echo "Unexpected output of $3"
+        STATUS=1
+    fi
+}
+# Summarized bodies are a single return
+compile_options_test summary
+$OPT -instr -summarize-bodies -S -o "$RESULT/summary.ll" "$RESULT/summary.bc" > /dev/null
+awk '/^define/ {match($0, /@[^(]*/); name = substr($0, RSTART + 1, RLENGTH - 1); n = 0; next}
+    /^}/ {if (name != "" && n == 1) print name; name = ""; next}
+    name != "" && /^  [^ ]/ {n++}' "$RESULT/summary.ll" | grep -v '^mypass_' | sort > "$RESULT/summary.bodies"
+check_output "$RESULT/summary.bodies" summary.expected -summarize-bodies
+# Declarations returning untracked types get a null return value
+compile_options_test models
+$OPT -instr -extern-spec="$OPTIONS_SRC/models.spec" -S -o "$RESULT/models.ll" "$RESULT/models.bc" > /dev/null
+sed -n '/^define.*@ext_/,/^}/p' "$RESULT/models.ll" > "$RESULT/models.bodies"
+check_output "$RESULT/models.bodies" models.expected -extern-spec
+# Devirtualized stubs call known targets directly, stubs of fields, that may get unknown values, keep the indirect call
+compile_options_test options
+compile_options_test escaped_field
+for test in options escaped_field; do
+    $OPT -instr -devirt-stubs -S -o "$RESULT/$test.devirt.ll" "$RESULT/$test.bc" > /dev/null
+    awk '/^define .*@mypass_.*_stub/ {match($0, /@[^(]*/); name = substr($0, RSTART + 1, RLENGTH - 1); kind = "direct"; next}
+        name != "" && /call [^@]*%[^ ]*\(/ {kind = "indirect"}
+        /^}/ {if (name != "") print name, kind; name = ""}' "$RESULT/$test.devirt.ll" | sort > "$RESULT/$test.stubs"
+    check_output "$RESULT/$test.stubs" "$test.devirt.expected" "-devirt-stubs on $test"
+done
+# Indirect calls get the functions stored into the fields they are loaded from
+$OPT -mlta -mlta-out="$RESULT/options.mlta" -disable-output "$RESULT/options.bc" > /dev/null
+awk '{split($1, site, "#"); for (i = 2; i <= NF; i++) print site[1], $i}' "$RESULT/options.mlta" | sort \
+    > "$RESULT/options.mlta.pairs"
+check_output "$RESULT/options.mlta.pairs" options.mlta.expected -mlta
+# Sites of the debug map and of -mlta share keys, debug info is stripped from the output
+$OPT -instr -debug-map-out="$RESULT/options.map" -S -o "$RESULT/options.stripped.ll" "$RESULT/options.bc" > /dev/null
+for line in 23 28; do
+    site=$(awk -v line=$line '$1 == "site" && $4 == line {print $2}' "$RESULT/options.map")
+    if [ -z "$site" ] || ! grep -q "^$site " "$RESULT/options.mlta"; then
+        echo "Call at line $line is not in the debug map"
+        STATUS=1
+    fi
+done
+if grep -q 'DISubprogram' "$RESULT/options.stripped.ll"; then
+    echo "Debug info is not stripped"
+    STATUS=1
+fi
+# Dry run counts what the phases would generate
+$OPT -instr -dry-run -devirt-stubs -call-stubs -disable-output "$RESULT/options.bc" | grep '^\[dry-run\] [a-z]' \
+    > "$RESULT/options.dry-run"
+check_output "$RESULT/options.dry-run" options.dry-run.expected -dry-run
+# The most valuable candidates are kept within the budget, devirtualized stubs cost more instructions
+for budget in "-budget-calls=1" "-budget-insts=12 -devirt-stubs"; do
+    $OPT -instr $budget -disable-output "$RESULT/options.bc" | grep '^\[budget\] dropped'
+done > "$RESULT/options.budget"
+check_output "$RESULT/options.budget" options.budget.expected -budget-*
+# Stubs are listed in the sidecar index
+$OPT -instr -index-out="$RESULT/options.idx" -disable-output "$RESULT/options.bc" > /dev/null
+if ! grep -aq 'mypass_struct.ops_0_stub' "$RESULT/options.idx"; then
+    echo "Stub is not in the sidecar index"
+    STATUS=1
+fi
+# Lazy loading gives the same module, debug info included
+"$PASS_PATH/ptr-instr" "$RESULT/options.bc" -o "$RESULT/options.full.bc" -summarize-bodies > /dev/null
+"$PASS_PATH/ptr-instr" "$RESULT/options.bc" -o "$RESULT/options.lazy.bc" -lazy -chunk-size=2 -summarize-bodies \
+    > /dev/null
+for mode in full lazy; do
+    llvm-dis-14 -o - "$RESULT/options.$mode.bc" | tail -n +2 > "$RESULT/options.$mode.ll"
+done
+if ! cmp -s "$RESULT/options.lazy.ll" "$RESULT/options.full.ll"; then
+    echo "Unexpected output of -lazy"
+    STATUS=1
+fi
+# Repeated server requests give the output of the standalone tool
+"$PASS_PATH/ptr-instr" "$RESULT/options.bc" -o "$RESULT/options.cli.bc" > /dev/null
+rm -f "$RESULT/instr.sock"
+"$PASS_PATH/ptr-instr" -serve="$RESULT/instr.sock" "$RESULT/options.bc" > /dev/null &
+python3 "$OPTIONS_SRC/server_client.py" "$RESULT/instr.sock" "INSTRUMENT $RESULT/options.srv1.bc" \
+    "INSTRUMENT $RESULT/options.srv2.bc" QUIT > "$RESULT/options.server"
+wait
+if [ "$(grep -c '^OK' "$RESULT/options.server")" != 3 ]; then
+    echo "Server request failed"
+    STATUS=1
+fi
+for file in cli srv1 srv2; do
+    llvm-dis-14 -o - "$RESULT/options.$file.bc" | tail -n +2 > "$RESULT/options.$file.ll"
+done
+for file in srv1 srv2; do
+    if ! cmp -s "$RESULT/options.$file.ll" "$RESULT/options.cli.ll"; then
+        echo "Server output differs from the standalone tool"
+        STATUS=1
+    fi
+done
+# Server doesn't remove a file, that is not a socket
+echo keep > "$RESULT/not_a_socket"
+if "$PASS_PATH/ptr-instr" -serve="$RESULT/not_a_socket" "$RESULT/options.bc" > /dev/null 2>&1 \
+    || [ "$(cat "$RESULT/not_a_socket")" != keep ]; then
+    echo "Server replaced a file, that is not a socket"
+    STATUS=1
+fi
+if ! "$PASS_PATH/sidecar_index_test" "$RESULT/roundtrip.idx"; then
+    STATUS=1
+fi
+# Traced programs run natively, observed targets must match the expected ones and be predicted by -mlta
+for file in "$TRACE_SRC"/*.c; do
+    FILE_NAME="$(basename "$file" .c)"
+    clang-14 -S -emit-llvm -o "$RESULT/$FILE_NAME.trace.ll" "$file"
+    opt-14 -enable-new-pm=0 -load="$PASS_PATH/ir_instr.so" -mlta -mlta-out="$RESULT/$FILE_NAME.mlta" \
+        -disable-output "$RESULT/$FILE_NAME.trace.ll" > /dev/null
+    opt-14 -enable-new-pm=0 -load="$PASS_PATH/ir_instr.so" -trace-icalls \
+        -o "$RESULT/$FILE_NAME.traced.bc" "$RESULT/$FILE_NAME.trace.ll" > /dev/null
+    clang-14 -rdynamic -o "$RESULT/$FILE_NAME" "$RESULT/$FILE_NAME.traced.bc" "$PASS_PATH/libptrtrack_rt.a" -ldl -lpthread
+    PTRTRACK_OUT="$RESULT/$FILE_NAME.trace" "$RESULT/$FILE_NAME"
+    if ! cut -d' ' -f2 "$RESULT/$FILE_NAME.trace" | sort | cmp -s - "$TRACE_SRC/$FILE_NAME.expected"; then
+        echo "Unexpected trace of $FILE_NAME"
+        STATUS=1
+    fi
+    while read -r site target; do
+        if ! grep -qE "^$site( .*)? $target( |\$)" "$RESULT/$FILE_NAME.mlta"; then
+            echo "Target $target of $site is not predicted by -mlta"
+            STATUS=1
+        fi
+    done < "$RESULT/$FILE_NAME.trace"
+done
+exit $STATUS
@@ -0,0 +1,37 @@
+/*
+ * Test that the tracing runtime reports every observed target once, including targets called from other threads
+ */
+#include <pthread.h>
+
+struct ops {
+	int (*op)(int);
+	int dummy;
+};
+
+int twice(int x) { return 2 * x; }
+int square(int x) { return x * x; }
+int negate(int x) { return -x; }
+
+struct ops table[] = {{twice, 0}, {square, 0}};
+
+int apply(struct ops *o, int x) {
+	// Expect negate, square and twice here
+	return o->op(x);
+}
+
+void *worker(void *arg) {
+	struct ops local = {negate, 0};
+	apply(&local, 3);
+	return arg;
+}
+
+int main() {
+	int sum = 0;
+	for (int i = 0; i < 1000; i++) {
+		sum += apply(&table[i % 2], i);
+	}
+	pthread_t thread;
+	pthread_create(&thread, 0, worker, 0);
+	pthread_join(thread, 0);
+	return sum == 0;
+}
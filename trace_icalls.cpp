@@ -0,0 +1,61 @@
+// Validation variant: every indirect call reports its site and the actual target to the runtime
+// (runtime/ptrtrack_rt.c), which writes observed pairs at exit. Sites are keyed by function#instruction index
+// of the input module, the same key as -mlta-out, so observed targets can be compared with the static ones.
+// The pass is meant for the original module, that runs natively, not for the output of -instr.
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/raw_ostream.h"
+#include "util.h"
+
+using namespace llvm;
+
+static const std::string TRACE_HOOK = "__ptrtrack_icall";
+
+struct TraceICallsPass : public ModulePass {
+    TraceICallsPass(): ModulePass(ID) {}
+
+    bool runOnModule(Module &M) override {
+        LLVMContext &ctx = M.getContext();
+        auto *i8_ptr = Type::getInt8PtrTy(ctx);
+        auto hook = M.getOrInsertFunction(
+                TRACE_HOOK, FunctionType::get(Type::getVoidTy(ctx), {i8_ptr, i8_ptr}, false)
+        );
+
+        // Indices are taken before hooks are inserted
+        std::vector<std::pair<CallBase*, std::string>> sites;
+        for (auto &f : M) {
+            size_t inst_idx = 0;
+            for (auto &bb : f) {
+                for (auto &inst : bb) {
+                    if (!isIndexedInstruction(inst)) {
+                        continue;
+                    }
+                    auto *call = dyn_cast<CallBase>(&inst);
+                    if (call && call->isIndirectCall()) {
+                        sites.emplace_back(call, f.getName().str() + "#" + std::to_string(inst_idx));
+                    }
+                    inst_idx++;
+                }
+            }
+        }
+        IRBuilder<> builder(ctx);
+        for (auto &[call, site] : sites) {
+            builder.SetInsertPoint(call);
+            auto *site_str = builder.CreateGlobalStringPtr(site, ".ptrtrack.site");
+            auto *target = builder.CreatePointerCast(call->getCalledOperand(), i8_ptr);
+            builder.CreateCall(hook, {site_str, target});
+        }
+        outs() << "Indirect calls traced: " << sites.size() << "\n";
+        outs().flush();
+        return !sites.empty();
+    }
+
+    static char ID;
+};
+
+char TraceICallsPass::ID = 0;
+
+static RegisterPass<TraceICallsPass> X("trace-icalls", "Report targets of indirect calls to the tracing runtime",
+                                       false /* Only looks at CFG */,
+                                       false /* Analysis Pass */);
@@ -0,0 +1,77 @@
+#include <fnmatch.h>
+#include "type_policy.h"
+#include "util.h"
+
+static void policyError(const std::string &path, const std::string &line, const std::string &msg) {
+    outs() << path << ": " << msg << " in line '" << line << "'\n";
+    outs().flush();
+    exit(1);
+}
+
+// Plain names go to a hash set, only real globs are matched one by one
+static void addPattern(StringRef pattern, std::unordered_set<std::string> &names,
+                       std::vector<std::string> &patterns) {
+    if (pattern.find_first_of("*?[\\") == StringRef::npos) {
+        names.insert(pattern.str());
+    } else {
+        patterns.push_back(pattern.str());
+    }
+}
+
+type_policy type_policy::fromFile(const std::string &path) {
+    type_policy policy;
+    for (auto &line : readConfigLines(path)) {
+        auto [key, value] = StringRef(line).split(' ');
+        value = value.trim();
+        if (value.empty()) {
+            policyError(path, line, "missing value");
+        }
+        if (key == "allow") {
+            addPattern(value, policy.allow_names, policy.allow_patterns);
+        } else if (key == "deny") {
+            addPattern(value, policy.deny_names, policy.deny_patterns);
+        } else if (key == "max-size" || key == "max-depth") {
+            uint64_t number;
+            if (value.getAsInteger(10, number)) {
+                policyError(path, line, "expected a number");
+            }
+            if (key == "max-size") {
+                policy.max_size = number;
+            } else {
+                policy.max_depth = number;
+            }
+        } else {
+            policyError(path, line, "unknown key");
+        }
+    }
+    return policy;
+}
+
+bool type_policy::matches(StringRef name, const std::unordered_set<std::string> &names,
+                          const std::vector<std::string> &patterns) {
+    auto name_str = name.str();
+    if (names.contains(name_str)) {
+        return true;
+    }
+    return std::ranges::any_of(patterns, [&name_str](const std::string &p) {
+        return fnmatch(p.c_str(), name_str.c_str(), 0) == 0;
+    });
+}
+
+bool type_policy::isAllowed(StructType *t, const DataLayout &DL) const {
+    auto name = t->hasName() ? t->getName() : StringRef();
+    if (matches(name, deny_names, deny_patterns)) {
+        return false;
+    }
+    if ((!allow_names.empty() || !allow_patterns.empty()) && !matches(name, allow_names, allow_patterns)) {
+        return false;
+    }
+    if (max_size && t->isSized() && DL.getTypeAllocSize(t) > *max_size) {
+        return false;
+    }
+    return true;
+}
+
+std::optional<size_t> type_policy::getMaxDepth() const {
+    return max_depth;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <optional>
+#include <unordered_set>
+#include "llvm/IR/IRBuilder.h"
+
+using namespace llvm;
+
+// Restricts which structs may become interesting.
+// Policy file consists of lines:
+//   allow <name or glob>   only matching structs may be interesting(if any allow line is given)
+//   deny <name or glob>    matching structs are never interesting, deny wins over allow
+//   max-size <bytes>       bigger structs are never interesting
+//   max-depth <n>          interest spreads at most n levels up from structs with function pointers
+class type_policy {
+public:
+    type_policy() = default;
+
+    static type_policy fromFile(const std::string &path);
+
+    [[nodiscard]] bool isAllowed(StructType *t, const DataLayout &DL) const;
+
+    [[nodiscard]] std::optional<size_t> getMaxDepth() const;
+private:
+    std::unordered_set<std::string> allow_names;
+    std::vector<std::string> allow_patterns;
+    std::unordered_set<std::string> deny_names;
+    std::vector<std::string> deny_patterns;
+    std::optional<uint64_t> max_size;
+    std::optional<size_t> max_depth;
+
+    static bool matches(StringRef name, const std::unordered_set<std::string> &names,
+                        const std::vector<std::string> &patterns);
+};
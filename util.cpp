@@ -1,4 +1,31 @@
 #include "util.h"
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+
+bool struct_name_less::operator()(const StructType *a, const StructType *b) const {
+    if (a == b) {
+        return false;
+    }
+    auto a_name = a->hasName() ? a->getName() : StringRef();
+    auto b_name = b->hasName() ? b->getName() : StringRef();
+    if (a_name != b_name) {
+        return a_name < b_name;
+    }
+    // Names are unique in a context, only unnamed structs get here. Clang never emits them.
+    return a < b;
+}
+
+bool struct_field_less::operator()(
+        const std::pair<StructType*, size_t> &a,
+        const std::pair<StructType*, size_t> &b
+) const {
+    if (a.first != b.first) {
+        return struct_name_less()(a.first, b.first);
+    }
+    return a.second < b.second;
+}
 
 bool isFunctionPointer(Type *t) {
     if (auto *PT = dyn_cast<PointerType>(t)) {
@@ -34,6 +61,66 @@ StructType* getStructType(Type *t) {
     return dereferenceStructPtr(t);
 }
 
+// Only bitcasts are stripped: zero-index GEPs point to the first field and must be kept
+static Value* stripBitCasts(Value *v) {
+    while (auto *cast = dyn_cast<BitCastOperator>(v)) {
+        v = cast->getOperand(0);
+    }
+    return v;
+}
+
+std::vector<std::pair<StructType*, size_t>> getAccessedFieldPath(Value *ptr) {
+    auto *gep = dyn_cast<GEPOperator>(stripBitCasts(ptr));
+    if (!gep || gep->getNumIndices() < 2) {
+        return {};
+    }
+    Type *cur = gep->getSourceElementType();
+    std::vector<std::pair<StructType*, size_t>> path;
+    bool points_to_field = false;
+    // The first index steps over the pointer itself
+    for (auto it = std::next(gep->idx_begin()); it != gep->idx_end(); it++) {
+        points_to_field = false;
+        if (auto *st = dyn_cast<StructType>(cur)) {
+            auto *idx = dyn_cast<ConstantInt>(it->get());
+            if (!idx) {
+                return {};
+            }
+            path.emplace_back(st, idx->getZExtValue());
+            points_to_field = true;
+            cur = st->getElementType(idx->getZExtValue());
+        } else if (auto *arr = dyn_cast<ArrayType>(cur)) {
+            cur = arr->getElementType();
+        } else if (auto *vec = dyn_cast<VectorType>(cur)) {
+            cur = vec->getElementType();
+        } else {
+            return {};
+        }
+    }
+    if (!points_to_field) {
+        return {};
+    }
+    return path;
+}
+
+std::optional<std::pair<StructType*, size_t>> getAccessedField(Value *ptr) {
+    auto path = getAccessedFieldPath(ptr);
+    if (path.empty()) {
+        return std::nullopt;
+    }
+    return path.back();
+}
+
+std::optional<std::pair<StructType*, size_t>> getCalledField(CallBase *call) {
+    if (call->getCalledFunction() || call->isInlineAsm()) {
+        return std::nullopt;
+    }
+    auto *load = dyn_cast<LoadInst>(stripBitCasts(call->getCalledOperand()));
+    if (!load) {
+        return std::nullopt;
+    }
+    return getAccessedField(load->getPointerOperand());
+}
+
 Value* copyStructBetweenPointers(Module &M, IRBuilder<> &builder, Type* T, Value* src, Value* dst) {
     return builder.CreateMemCpy(
             dst,
@@ -44,6 +131,62 @@ Value* copyStructBetweenPointers(Module &M, IRBuilder<> &builder, Type* T, Value
     );
 }
 
+std::vector<std::string> readConfigLines(const std::string &path) {
+    auto buffer = MemoryBuffer::getFile(path);
+    if (!buffer) {
+        outs() << "Cannot read " << path << ": " << buffer.getError().message() << "\n";
+        outs().flush();
+        exit(1);
+    }
+    std::vector<std::string> lines;
+    SmallVector<StringRef> raw_lines;
+    (*buffer)->getBuffer().split(raw_lines, '\n');
+    for (auto line : raw_lines) {
+        line = line.split('#').first.trim();
+        if (!line.empty()) {
+            lines.push_back(line.str());
+        }
+    }
+    return lines;
+}
+
+std::optional<std::string> getSourcePath(const GlobalValue *v) {
+    StringRef directory, file;
+    if (auto *f = dyn_cast<Function>(v)) {
+        auto *sp = f->getSubprogram();
+        if (!sp) {
+            return std::nullopt;
+        }
+        directory = sp->getDirectory();
+        file = sp->getFilename();
+    } else if (auto *glob = dyn_cast<GlobalVariable>(v)) {
+        SmallVector<DIGlobalVariableExpression*, 1> debug_info;
+        glob->getDebugInfo(debug_info);
+        if (debug_info.empty()) {
+            return std::nullopt;
+        }
+        directory = debug_info.front()->getVariable()->getDirectory();
+        file = debug_info.front()->getVariable()->getFilename();
+    } else {
+        return std::nullopt;
+    }
+    return joinSourcePath(directory, file);
+}
+
+std::string joinSourcePath(StringRef directory, StringRef file) {
+    SmallString<256> path;
+    if (!sys::path::is_absolute(file)) {
+        path = directory;
+    }
+    sys::path::append(path, file);
+    sys::path::remove_dots(path, true);
+    return path.str().str();
+}
+
+bool isIndexedInstruction(const Instruction &inst) {
+    return !isa<DbgInfoIntrinsic>(inst);
+}
+
 std::unordered_set<Type*> findAllStructsByName(Module &M, const std::unordered_set<std::string> &names) {
     std::unordered_set<Type*> found;
     for (auto s : M.getIdentifiedStructTypes()) {
@@ -54,4 +197,37 @@ std::unordered_set<Type*> findAllStructsByName(Module &M, const std::unordered_s
     }
     outs().flush();
     return found;
-}
\ No newline at end of file
+}
+
+constant_walker::constant_walker(visitor_fn visitor): visitor(std::move(visitor)) {}
+
+Constant* constant_walker::walk(Constant *c) {
+    if (auto it = memo.find(c); it != memo.end()) {
+        return it->second;
+    }
+    Constant *result = c;
+    if (!isa<GlobalValue>(c) && (isa<ConstantExpr>(c) || isa<ConstantAggregate>(c))) {
+        std::vector<Constant*> ops;
+        bool changed = false;
+        for (auto &op : c->operands()) {
+            auto *op_const = dyn_cast<Constant>(op.get());
+            auto *new_op = walk(op_const);
+            changed |= new_op != op_const;
+            ops.push_back(new_op);
+        }
+        if (changed) {
+            if (auto *ce = dyn_cast<ConstantExpr>(c)) {
+                result = ce->getWithOperands(ops);
+            } else if (auto *cs = dyn_cast<ConstantStruct>(c)) {
+                result = ConstantStruct::get(cs->getType(), ops);
+            } else if (auto *ca = dyn_cast<ConstantArray>(c)) {
+                result = ConstantArray::get(ca->getType(), ops);
+            } else {
+                result = ConstantVector::get(ops);
+            }
+        }
+    }
+    result = visitor(result);
+    memo[c] = result;
+    return result;
+}
@@ -1,9 +1,22 @@
 #pragma once
+#include <functional>
+#include <optional>
 #include <unordered_set>
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/IR/IRBuilder.h"
 
 using namespace llvm;
 
+// Orders identified structs by name, so iteration order doesn't depend on heap addresses
+struct struct_name_less {
+    bool operator()(const StructType *a, const StructType *b) const;
+};
+
+// Orders (struct, field index) pairs by struct name, then by field index
+struct struct_field_less {
+    bool operator()(const std::pair<StructType*, size_t> &a, const std::pair<StructType*, size_t> &b) const;
+};
+
 // Check if it is a function pointer type
 bool isFunctionPointer(Type *t);
 
@@ -15,6 +28,47 @@ StructType* dereferenceStructPtr(Type *t);
 // T or T* return T
 StructType* getStructType(Type *t);
 
+// If ptr points exactly to a struct field(GEP with constant struct indices), return all (struct, field index)
+// pairs on the way from the outermost struct to the innermost one. Empty if the field is not known.
+std::vector<std::pair<StructType*, size_t>> getAccessedFieldPath(Value *ptr);
+
+// If ptr points exactly to a struct field(GEP with constant struct indices), return this struct and field index
+// For nested fields the innermost struct is returned
+std::optional<std::pair<StructType*, size_t>> getAccessedField(Value *ptr);
+
+// If this is an indirect call of a function pointer loaded from a struct field, return this field
+std::optional<std::pair<StructType*, size_t>> getCalledField(CallBase *call);
+
 Value* copyStructBetweenPointers(Module &M, IRBuilder<> &builder, Type* T, Value* src, Value* dst);
 
+// Read a config file: every line is trimmed, empty lines and '#' comments are dropped
+// Exits if the file cannot be read
+std::vector<std::string> readConfigLines(const std::string &path);
+
+// Source file of a function or a global variable from debug info, dots are removed from the path
+std::optional<std::string> getSourcePath(const GlobalValue *v);
+
+// File of debug info relative to its compilation directory, dots are removed from the result
+std::string joinSourcePath(StringRef directory, StringRef file);
+
+// Instructions counted in "function#index" keys of the sidecar index, debug map, -mlta-out and traces.
+// Keys number input bodies, debug intrinsics are skipped, so debug info doesn't change them
+bool isIndexedInstruction(const Instruction &inst);
+
 std::unordered_set<Type*> findAllStructsByName(Module &M, const std::unordered_set<std::string> &names);
+
+// Walks nested constant expressions and aggregates, visiting every distinct constant once.
+// Visitor may return a replacement for a constant, parents of replaced constants are rebuilt.
+// Globals are leaves: their initializers must be walked explicitly.
+class constant_walker {
+public:
+    using visitor_fn = std::function<Constant*(Constant*)>;
+
+    explicit constant_walker(visitor_fn visitor);
+
+    // Return rewritten constant or the same one if nothing was replaced
+    Constant* walk(Constant *c);
+private:
+    visitor_fn visitor;
+    DenseMap<Constant*, Constant*> memo;
+};